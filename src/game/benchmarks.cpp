@@ -0,0 +1,505 @@
+#include "benchmarks.h"
+
+#include <chrono>
+#include <filesystem>
+#include <random>
+#include <span>
+
+#include "game/main.h"
+#include "game/map.h"
+#include "game/particles.h"
+#include "utils/packing.h"
+
+namespace Benchmarks
+{
+    // Calls `func` repeatedly for at least `min_seconds`, and returns the average time per call in seconds.
+    // `func` should return its result, which is then discarded in a way that prevents the optimizer from removing the computation.
+    template <typename F>
+    [[nodiscard]] static double SecondsPerCall(F &&func, double min_seconds = 0.25)
+    {
+        static volatile std::uint64_t sink = 0;
+
+        sink = sink + std::uint64_t(func()); // Warm up.
+
+        auto start = std::chrono::steady_clock::now();
+        std::size_t calls = 0;
+        double elapsed = 0;
+        do
+        {
+            sink = sink + std::uint64_t(func());
+            calls++;
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        while (elapsed < min_seconds);
+
+        return elapsed / calls;
+    }
+
+    static void PrintResult(std::string_view label, double value, std::string_view unit)
+    {
+        std::cout << FMT("    {:<56} {:>12.2f} {}\n", label, value, unit);
+    }
+
+    // The biggest map the benchmarks use, built by repeating a real level.
+    [[nodiscard]] static const Map &LargeMap()
+    {
+        static const Map ret = Map("assets/maps/1.json").Repeated(ivec2(1024));
+        return ret;
+    }
+
+    static void MapCells()
+    {
+        // The cell layout `Map` used before the cells were split into planes.
+        struct LegacyCell
+        {
+            Tile tile;
+            std::uint8_t random = 0;
+            int corruption_stage = 0;
+            int corruption_start_time = 0;
+            int damage = 0;
+            int visual_damage = 0;
+        };
+
+        const Map &map = LargeMap();
+        Array2D<LegacyCell> legacy(map.Size());
+        for (ivec2 pos : vector_range(map.Size()))
+            legacy.unsafe_at(pos) = {.tile = map.GetTile(pos), .random = map.GetRandom(pos)};
+
+        double cell_count = map.Size().prod();
+
+        PrintResult("Bytes per cell, one struct per cell", sizeof(LegacyCell), "B");
+        // Tile, random value, solidity bit, corruption, merge mask.
+        PrintResult("Bytes per cell, planes", sizeof(Tile) + sizeof(std::uint8_t) + 1 / 8. + sizeof(Map::CellCorruption) + sizeof(std::uint8_t), "B");
+
+        auto Sweep = [&](std::string_view name, auto &&legacy_func, auto &&planes_func)
+        {
+            PrintResult(FMT("{}, one struct per cell", name), cell_count / SecondsPerCall(legacy_func) / 1e6, "Mcells/s");
+            PrintResult(FMT("{}, planes", name), cell_count / SecondsPerCall(planes_func) / 1e6, "Mcells/s");
+        };
+
+        Sweep("Tiles and random values (render)",
+            [&]{
+                int ret = 0;
+                for (const LegacyCell &cell : std::span(legacy.elements(), legacy.element_count()))
+                    ret += int(cell.tile) + cell.random;
+                return ret;
+            },
+            [&]{
+                int ret = 0;
+                for (ivec2 pos : vector_range(map.Size()))
+                    ret += int(map.GetTile(pos)) + map.GetRandom(pos);
+                return ret;
+            }
+        );
+
+        Sweep("Solidity (collision)",
+            [&]{
+                int ret = 0;
+                for (const LegacyCell &cell : std::span(legacy.elements(), legacy.element_count()))
+                    ret += GetTileInfo(cell.tile).solid;
+                return ret;
+            },
+            [&]{
+                int ret = 0;
+                for (ivec2 pos : vector_range(map.Size()))
+                    ret += map.TileIsSolid(pos);
+                return ret;
+            }
+        );
+
+        Sweep("Corruption stages (tick)",
+            [&]{
+                int ret = 0;
+                for (const LegacyCell &cell : std::span(legacy.elements(), legacy.element_count()))
+                    ret += cell.corruption_stage;
+                return ret;
+            },
+            [&]{
+                int ret = 0;
+                for (ivec2 pos : vector_range(map.Size()))
+                    ret += map.GetCorruption(pos).stage;
+                return ret;
+            }
+        );
+    }
+
+    static void Movement()
+    {
+        constexpr int body_count = 10000;
+        // Same as the player hitbox.
+        constexpr ivec2 hitbox_a = ivec2(-4, -5), hitbox_b = ivec2(3, 4);
+
+        const Map &map = LargeMap();
+
+        struct Body
+        {
+            ivec2 pos;
+            ivec2 vel;
+        };
+        std::vector<Body> bodies(body_count);
+        std::vector<ivec2> step_results(body_count), sweep_results(body_count), move_rect_results(body_count);
+
+        // The per-pixel loop that the movement code used before `SweepMove()`.
+        auto Step = [&]{
+            int ret = 0;
+            for (int i = 0; i < body_count; i++)
+            {
+                ivec2 pos = bodies[i].pos;
+                ivec2 int_vel = bodies[i].vel;
+                while (int_vel)
+                {
+                    for (int j : {0, 1})
+                    {
+                        if (int_vel[j] == 0)
+                            continue;
+
+                        int s = sign(int_vel[j]);
+                        ivec2 offset{};
+                        offset[j] = s;
+
+                        if (!map.AnyPixelSolidInRect(pos + offset + hitbox_a, pos + offset + hitbox_b))
+                        {
+                            pos[j] += s;
+                            int_vel[j] -= s;
+                        }
+                        else
+                        {
+                            int_vel[j] = 0;
+                        }
+                    }
+                }
+                step_results[i] = pos;
+                ret += pos.x;
+            }
+            return ret;
+        };
+
+        auto Sweep = [&]{
+            int ret = 0;
+            for (int i = 0; i < body_count; i++)
+            {
+                ivec2 pos = bodies[i].pos;
+                (void)SweepMove(pos, bodies[i].vel, [&](ivec2 pos, int axis, int dir, int max_dist){return map.RectFreeDistance(pos + hitbox_a, pos + hitbox_b, axis, dir, max_dist);});
+                sweep_results[i] = pos;
+                ret += pos.x;
+            }
+            return ret;
+        };
+
+        auto MoveRect = [&]{
+            int ret = 0;
+            for (int i = 0; i < body_count; i++)
+            {
+                ivec2 pos = bodies[i].pos;
+                (void)map.MoveRect(pos, bodies[i].vel, hitbox_a, hitbox_b);
+                move_rect_results[i] = pos;
+                ret += pos.x;
+            }
+            return ret;
+        };
+
+        // The bodies start in the free space, and move in random directions.
+        for (int max_speed : {4, 16, 64})
+        {
+            std::minstd_rand generator(42);
+            Random::Scalar<int, std::minstd_rand> rand(generator);
+
+            for (Body &body : bodies)
+            {
+                do
+                    body.pos = ivec2(0 <= rand < map.Size().x * tile_size, 0 <= rand < map.Size().y * tile_size);
+                while (map.AnyPixelSolidInRect(body.pos + hitbox_a, body.pos + hitbox_b));
+
+                body.vel = ivec2(-max_speed <= rand <= max_speed, -max_speed <= rand <= max_speed);
+            }
+
+            PrintResult(FMT("Speed up to {} px, per-pixel stepping", max_speed), body_count / SecondsPerCall(Step) / 1e3, "bodies/ms");
+            PrintResult(FMT("Speed up to {} px, SweepMove() + RectFreeDistance()", max_speed), body_count / SecondsPerCall(Sweep) / 1e3, "bodies/ms");
+            PrintResult(FMT("Speed up to {} px, Map::MoveRect()", max_speed), body_count / SecondsPerCall(MoveRect) / 1e3, "bodies/ms");
+
+            if (step_results != sweep_results || step_results != move_rect_results)
+                Program::Error("The swept movement gave different results than the per-pixel stepping.");
+        }
+    }
+
+    static void MapRender()
+    {
+        // `Map::Render()` uses the texture atlas and the global renderer.
+        InitWindow(true);
+        InitGraphics();
+
+        Map map = LargeMap();
+        // Looking at a chunk corner, so four chunks are visible.
+        ivec2 camera_pos = map.Size() / 2 * tile_size;
+        ivec2 changed_tile = map.Size() / 2;
+
+        Render::CommandList list;
+        auto Draw = [&]{
+            list.Clear();
+            r.BeginRecording(list);
+            map.Render(camera_pos);
+            r.EndRecording();
+            return list.vertices.size();
+        };
+
+        // Changing a tile rebuilds the meshes of its chunk and the neighboring ones.
+        auto ChangeAndDraw = [&]{
+            Tile tile = map.GetTile(changed_tile);
+            map.SetTile(changed_tile, tile == Tile::air ? Tile::wall : Tile::air);
+            map.SetTile(changed_tile, tile);
+            return Draw();
+        };
+
+        PrintResult(FMT("Up-to-date meshes, {} quads", Draw() / 4), SecondsPerCall(Draw) * 1e6, "us/frame");
+        PrintResult("After a tile change", SecondsPerCall(ChangeAndDraw) * 1e6, "us/frame");
+    }
+
+    static void Quads()
+    {
+        constexpr int quad_count = 10000;
+
+        Render render = Render::Headless();
+        Render::CommandList list;
+        std::vector<Render::CommandList::Vertex> uniform_vertices;
+
+        // Records `quad_count` quads, each drawn with `emit(render, pos)`.
+        auto Measure = [&](std::string_view label, auto &&emit)
+        {
+            auto Record = [&]{
+                list.Clear();
+                render.BeginRecording(list);
+                for (int i = 0; i < quad_count; i++)
+                    emit(fvec2(i % 256, i / 256));
+                render.EndRecording();
+                return list.vertices.size();
+            };
+            PrintResult(label, quad_count / SecondsPerCall(Record) / 1e6, "Mquads/s");
+        };
+
+        // Checks that the last two measurements produced the same vertices.
+        auto SaveVertices = [&]{uniform_vertices = list.vertices;};
+        auto CheckVertices = [&]
+        {
+            if (!std::equal(list.vertices.begin(), list.vertices.end(), uniform_vertices.begin(), uniform_vertices.end(), [](const auto &a, const auto &b)
+            {
+                return a.pos == b.pos && a.color == b.color && a.texcoord == b.texcoord && a.factors == b.factors;
+            }))
+            {
+                Program::Error("The uniform quads don't match the general ones.");
+            }
+        };
+
+        // `alpha()` with four arguments turns a uniform quad into a general one.
+        Measure("Untextured, uniform", [&](fvec2 pos){render.fquad(pos, fvec2(12)).color(fvec3(1, 0.5f, 0)).alpha(0.5f);});
+        SaveVertices();
+        Measure("Untextured, same through the general path", [&](fvec2 pos){render.fquad(pos, fvec2(12)).color(fvec3(1, 0.5f, 0)).alpha(0.5f, 0.5f, 0.5f, 0.5f);});
+        CheckVertices();
+        Measure("Textured, uniform", [&](fvec2 pos){render.fquad(pos, fvec2(12)).tex(fvec2(24, 36)).center().flip_x();});
+        SaveVertices();
+        Measure("Textured, same through the general path", [&](fvec2 pos){render.fquad(pos, fvec2(12)).tex(fvec2(24, 36)).center().flip_x().alpha(1, 1, 1, 1);});
+        CheckVertices();
+        Measure("Textured, with a matrix", [&](fvec2 pos){render.fquad(pos, fvec2(12)).tex(fvec2(24, 36)).center().rotate(0.5f);});
+    }
+
+    static void Corruption()
+    {
+        constexpr int num_ticks = 300;
+
+        std::cout << FMT("    (The two-phase mode uses {} threads.)\n", thread_pool.ThreadCount());
+
+        for (int size : {64, 128, 256, 512, 1024})
+        {
+            // The corruption starts at a grid of points, and spreads from them. Only some tiles are corruptable, so we corrupt small areas around each point.
+            Map base = LargeMap().Repeated(ivec2(size));
+            for (int y = 0; y < size; y += 32)
+            for (int x = 0; x < size; x += 32)
+            for (auto pos : vector_range(ivec2(8)))
+                base.CorrputTile(ivec2(x, y) + pos, Map::num_corruption_stages);
+
+            for (bool two_phase : {false, true})
+            {
+                Map map = base;
+                map.two_phase_tick = two_phase;
+                map.play_sounds = false;
+                ParticleController par;
+
+                auto start = std::chrono::steady_clock::now();
+                for (int i = 0; i < num_ticks; i++)
+                    map.Tick(par);
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+                int corrupted = 0;
+                for (auto pos : vector_range(map.ChunkGridSize()))
+                    corrupted += map.GetChunk(pos).num_corrupted;
+                PrintResult(FMT("{}x{} map, {}, {} cells left", size, size, two_phase ? "two-phase" : "sequential", corrupted), seconds / num_ticks * 1e3, "ms/tick");
+            }
+        }
+    }
+
+    static void Particles()
+    {
+        for (int count : {10'000, 100'000, 1'000'000})
+        {
+            std::minstd_rand generator(42);
+            Random::Scalar<float, std::minstd_rand> rand(generator);
+
+            // The particles never die, so the count stays the same between the calls.
+            std::vector<Particle> particles(count);
+            for (Particle &par : particles)
+            {
+                par.pos = fvec2(0 <= rand <= 1000, 0 <= rand <= 1000);
+                par.vel = fvec2(rand.abs() <= 1, rand.abs() <= 1);
+                par.acc = fvec2(0, 0 <= rand <= 0.01f);
+                par.drag = 0.01f;
+                par.max_time = std::numeric_limits<int>::max();
+                par.color = fvec3(1, 0.5f, 0);
+            }
+
+            // The array of structures that `ParticleController` used before it was split into separate arrays.
+            std::vector<Particle> legacy = particles;
+            auto LegacyTick = [&]{
+                for (Particle &par : legacy)
+                {
+                    par.time++;
+                    par.vel += par.acc;
+                    par.vel *= 1 - par.drag;
+                    par.pos += par.vel;
+                }
+                std::erase_if(legacy, [](const Particle &par){return par.time >= par.max_time;});
+                return legacy.size();
+            };
+
+            ParticleController::Budget budget;
+            budget.max_particles = count;
+            budget.spawn_limit_fraction.fill(1);
+            ParticleController controller(budget);
+            for (const Particle &par : particles)
+                controller.Add(par);
+            if (controller.Count() != particles.size())
+                Program::Error("Some particles were dropped.");
+            auto Tick = [&]{
+                controller.Tick();
+                return controller.Count();
+            };
+
+            PrintResult(FMT("{} particles, array of structures", count), count / SecondsPerCall(LegacyTick) / 1e6, "Mparticles/s");
+            PrintResult(FMT("{} particles, ParticleController::Tick()", count), count / SecondsPerCall(Tick) / 1e6, "Mparticles/s");
+        }
+    }
+
+    static void AtlasPacking()
+    {
+        struct RectSet
+        {
+            std::string name;
+            ivec2 target_size;
+            int inner_gaps = 0;
+            std::vector<Packing::Rect> rects;
+        };
+        std::vector<RectSet> sets;
+
+        // The images of the game's atlas, with the same parameters.
+        if (std::filesystem::exists("assets/_images"))
+        {
+            RectSet &set = sets.emplace_back(RectSet{.name = "Game atlas", .target_size = ivec2(2048), .inner_gaps = 1});
+            set.rects.push_back(ivec2(256)); // The font region.
+            for (const auto &entry : std::filesystem::recursive_directory_iterator("assets/_images"))
+            {
+                if (entry.is_regular_file())
+                    set.rects.push_back(Graphics::Image(entry.path().string()).Size());
+            }
+            set.name = FMT("Game atlas, {} images", set.rects.size());
+        }
+        else
+        {
+            std::cout << "    The atlas source images are missing, skipping them.\n";
+        }
+
+        std::minstd_rand generator(42);
+        Random::Scalar<int, std::minstd_rand> rand(generator);
+        auto AddSyntheticSet = [&](int count, int min_size, int max_size)
+        {
+            RectSet &set = sets.emplace_back(RectSet{.name = FMT("{} random rects, {}-{}px", count, min_size, max_size), .target_size = ivec2(2048), .inner_gaps = 1});
+            for (int i = 0; i < count; i++)
+                set.rects.push_back(ivec2(min_size <= rand <= max_size, min_size <= rand <= max_size));
+        };
+        AddSyntheticSet(1000, 8, 32);
+        AddSyntheticSet(300, 8, 128);
+
+        const std::pair<Packing::Algorithm, std::string_view> algorithms[] = {
+            {Packing::Algorithm::skyline_bottom_left, "skyline, bottom-left"},
+            {Packing::Algorithm::skyline_best_fit, "skyline, best fit"},
+            {Packing::Algorithm::max_rects_best_short_side_fit, "MaxRects"},
+        };
+
+        for (const RectSet &set : sets)
+        for (const auto &[algorithm, algorithm_name] : algorithms)
+        for (bool allow_rotation : {false, true})
+        {
+            Packing::Params params;
+            params.algorithm = algorithm;
+            params.allow_rotation = allow_rotation;
+            params.inner_gaps = set.inner_gaps;
+
+            std::vector<Packing::Rect> rects;
+            Packing::Result result;
+            auto Pack = [&]
+            {
+                rects = set.rects;
+                result = Packing::PackRects(set.target_size, rects.data(), rects.size(), params);
+                return result.not_packed;
+            };
+
+            std::string label = FMT("{}, {}{}", set.name, algorithm_name, allow_rotation ? ", rotated" : "");
+            PrintResult(label, SecondsPerCall(Pack) * 1e3, "ms");
+            // The occupancy of the used part is what matters, since the atlas can be shrunk to it.
+            PrintResult(FMT("    used {}x{}{}", result.used_size.x, result.used_size.y, result.not_packed ? FMT(", {} didn't fit", result.not_packed) : ""), result.used_occupancy * 100, "% occupied");
+
+            // Binary search for the smallest square box that fits everything.
+            int min_side = 1, max_side = set.target_size.max() * 2;
+            while (min_side < max_side)
+            {
+                int side = (min_side + max_side) / 2;
+                rects = set.rects;
+                if (Packing::PackRects(ivec2(side), rects.data(), rects.size(), params).not_packed == 0)
+                    max_side = side;
+                else
+                    min_side = side + 1;
+            }
+            PrintResult("    smallest square box that fits everything", min_side, "px");
+        }
+    }
+
+    struct Benchmark
+    {
+        std::string_view name;
+        std::string_view description;
+        void (*func)() = nullptr;
+    };
+
+    static const Benchmark benchmarks[] = {
+        {"map_cells", "Map cell storage, on a 1024x1024 map", MapCells},
+        {"movement", "Moving 10000 bodies against the tiles of a 1024x1024 map", Movement},
+        {"particles", "Ticking particles, compared to the old array of structures", Particles},
+        {"map_render", "Drawing the visible part of a 1024x1024 map", MapRender},
+        {"quads", "Recording 10000 quads with a headless renderer", Quads},
+        {"corruption", "Spreading the corruption for 300 ticks on maps of different sizes", Corruption},
+        {"atlas_packing", "Packing the atlas images and random rectangles with each algorithm", AtlasPacking},
+    };
+
+    void Run(const std::vector<std::string> &filters)
+    {
+        #ifndef NDEBUG
+        std::cout << "Warning: this is a debug build, the results are not representative. Use the release mode.\n";
+        #endif
+
+        for (const Benchmark &bench : benchmarks)
+        {
+            if (!filters.empty() && std::none_of(filters.begin(), filters.end(), [&](const std::string &filter){return bench.name.starts_with(filter);}))
+                continue;
+
+            std::cout << bench.name << " - " << bench.description << ":\n";
+            bench.func();
+        }
+    }
+}
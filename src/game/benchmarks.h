@@ -0,0 +1,11 @@
+#pragma once
+
+// Benchmarks for the engine and the game code. They are not a part of the normal startup.
+// Run them with `brimstone --bench [names...]`, preferably in the release mode.
+// The game globals aren't initialized at that point. The benchmarks that need them call `InitWindow(true)` (for a hidden window) and `InitGraphics()`.
+namespace Benchmarks
+{
+    // Runs the benchmarks whose names begin with any of `filters`, or all of them if `filters` is empty.
+    // Prints the results to `std::cout`.
+    void Run(const std::vector<std::string> &filters);
+}
@@ -1,11 +1,17 @@
 #include "main.h"
 
+#include "game/benchmarks.h"
+#include "game/tests.h"
+
 const std::string_view window_name = "BRIMSTONE";
 
-Interface::Window window(std::string(window_name), screen_size * 2, Interface::windowed, adjust_(Interface::WindowSettings{}, min_size = screen_size));
-static Graphics::DummyVertexArray dummy_vao = nullptr;
+// Most of the globals below start empty, and are created by `InitWindow()` and `InitGraphics()`.
+// This lets the tests and the benchmarks run without a window or the game assets, unless they need them.
+
+Interface::Window window;
+static Graphics::DummyVertexArray dummy_vao;
 
-static Audio::Context audio_context = nullptr;
+static Audio::Context audio_context;
 Audio::SourceManager audio_controller;
 
 const Graphics::ShaderConfig shader_config = Graphics::ShaderConfig::Core();
@@ -15,32 +21,75 @@ namespace Fonts
 {
     namespace Files
     {
-        Graphics::FontFile main("assets/CatIV15.ttf", 15);
+        Graphics::FontFile main;
     }
 
     Graphics::Font main;
 }
 
-Graphics::TextureAtlas texture_atlas = []{
-    Graphics::TextureAtlas ret(ivec2(2048), std::filesystem::exists("assets/_images") ? "assets/_images" : "", "assets/atlas.png", "assets/atlas.refl", {{"/font_storage", ivec2(256)}});
-    auto font_region = ret.Get("/font_storage");
+ThreadPool thread_pool; // This is used when building the atlas, so it must be initialized before it.
 
-    Unicode::CharSet glyph_ranges;
-    glyph_ranges.Add(Unicode::Ranges::Basic_Latin);
+Graphics::TextureAtlas texture_atlas;
+Graphics::Texture texture_main;
 
-    Graphics::MakeFontAtlas(ret.GetImage(), font_region.pos, font_region.size, {
-        {Fonts::main, Fonts::Files::main, glyph_ranges, Graphics::FontFile::hinting_mode_light},
-    });
-    return ret;
-}();
+Graphics::Texture framebuffer_texture_map;
+Graphics::FrameBuffer framebuffer_map;
 
-Graphics::Texture texture_main = Graphics::Texture(nullptr).Wrap(Graphics::clamp).Interpolation(Graphics::nearest).SetData(texture_atlas.GetImage());
+GameUtils::AdaptiveViewport adaptive_viewport;
+Render r;
+SpriteRender sprite_render;
 
-Graphics::Texture framebuffer_texture_map = Graphics::Texture(nullptr).Wrap(Graphics::clamp).Interpolation(Graphics::nearest).SetData(screen_size);
-Graphics::FrameBuffer framebuffer_map(framebuffer_texture_map);
+void InitWindow(bool hidden)
+{
+    if (window)
+        return;
+
+    Interface::WindowSettings settings;
+    settings.min_size = screen_size;
+    settings.hidden = hidden;
+    window = Interface::Window(std::string(window_name), screen_size * 2, Interface::windowed, settings);
+    dummy_vao = nullptr;
+}
 
-GameUtils::AdaptiveViewport adaptive_viewport(shader_config, screen_size);
-Render r = adjust_(Render(0x2000, shader_config), SetTexture(texture_main), SetMatrix(adaptive_viewport.GetDetails().MatrixCentered()));
+void InitGraphics()
+{
+    if (r)
+        return;
+
+    InitWindow();
+
+    Fonts::Files::main = Graphics::FontFile("assets/CatIV15.ttf", 15);
+
+    // 2048x2048 is the maximum size, the atlas is shrunk to the used part.
+    texture_atlas = Graphics::TextureAtlas(ivec2(2048), std::filesystem::exists("assets/_images") ? "assets/_images" : "", "assets/atlas.png", "assets/atlas.refl", {{"/font_storage", ivec2(256)}}, true, &thread_pool, {"assets/atlas.bin"}, true);
+    auto font_region = texture_atlas.Get("/font_storage");
+
+    Unicode::CharSet glyph_ranges;
+    glyph_ranges.Add(Unicode::Ranges::Basic_Latin);
+
+    Graphics::MakeFontAtlas(texture_atlas.GetImage(), font_region.pos, font_region.size, {
+        {Fonts::main, Fonts::Files::main, glyph_ranges, Graphics::FontFile::hinting_mode_light},
+    }, true, &thread_pool);
+
+    #ifndef NDEBUG
+    const auto &stats = texture_atlas.GetBuildStats();
+    std::cout << STR("Texture atlas: ", (stats.regenerated ? "rebuilt" : stats.changed_images ? "patched" : stats.loaded_binary_cache ? "loaded from binary cache" : "loaded"),
+        ", ", (stats.image_count), " images (", (stats.changed_images), " changed) in ", (int(stats.total_seconds * 1000)), "ms",
+        " (decode ", (int(stats.decode_seconds * 1000)), "ms, pack ", (int(stats.pack_seconds * 1000)), "ms, save ", (int(stats.save_seconds * 1000)), "ms)",
+        ", ", (texture_atlas.GetImage().Size().x), "x", (texture_atlas.GetImage().Size().y), "\n");
+    if (stats.regenerated)
+        std::cout << STR("Texture atlas: used ", (stats.used_size.x), "x", (stats.used_size.y), ", ", (int(stats.occupancy * 100)), "% of the maximum size is occupied\n");
+    #endif
+
+    texture_main = Graphics::Texture(nullptr).Wrap(Graphics::clamp).Interpolation(Graphics::nearest).SetData(texture_atlas.GetImage());
+
+    framebuffer_texture_map = Graphics::Texture(nullptr).Wrap(Graphics::clamp).Interpolation(Graphics::nearest).SetData(screen_size);
+    framebuffer_map = Graphics::FrameBuffer(framebuffer_texture_map);
+
+    adaptive_viewport = GameUtils::AdaptiveViewport(shader_config, screen_size);
+    r = adjust_(Render(0x2000, shader_config), SetTexture(texture_main), SetMatrix(adaptive_viewport.GetDetails().MatrixCentered()));
+    sprite_render = adjust_(SpriteRender(shader_config), SetTexture(texture_main), SetMatrix(adaptive_viewport.GetDetails().MatrixCentered()));
+}
 
 Input::Mouse mouse;
 
@@ -88,8 +137,11 @@ struct ProgramState : Program::DefaultBasicState
     void EndFrame() override
     {
         fps_counter.Update();
+        Render::QueueStats render_stats = r.TakeQueueStats();
         #ifndef NDEBUG
-        window.SetTitle(STR((window_name), " TPS:", (fps_counter.Tps()), " FPS:", (fps_counter.Fps()), " AUDIO:", (audio_controller.ActiveSources())));
+        window.SetTitle(STR((window_name), " TPS:", (fps_counter.Tps()), " FPS:", (fps_counter.Fps()), " AUDIO:", (audio_controller.ActiveSources()), " FLUSHES:", (render_stats.flushes), " UPLOAD:", (render_stats.bytes_uploaded / 1024), "K"));
+        #else
+        (void)render_stats;
         #endif
 
         if (!state_manager)
@@ -134,6 +186,9 @@ struct ProgramState : Program::DefaultBasicState
 
     void Init()
     {
+        InitGraphics();
+        audio_context = nullptr;
+
         ApplyFullscreenMode();
         mouse.HideCursor();
 
@@ -150,8 +205,24 @@ struct ProgramState : Program::DefaultBasicState
     }
 };
 
-IMP_MAIN(,)
+IMP_MAIN(argc, argv)
 {
+    std::vector<std::string> args(argv + 1, argv + argc);
+
+    // `--bench [names...]` runs the benchmarks instead of the game. They don't create the window unless they need it.
+    if (!args.empty() && args.front() == "--bench")
+    {
+        Benchmarks::Run(std::vector<std::string>(args.begin() + 1, args.end()));
+        return 0;
+    }
+
+    // `--test [names...]` runs the tests instead of the game. Same, the window is only created if needed.
+    if (!args.empty() && args.front() == "--test")
+    {
+        Tests::Run(std::vector<std::string>(args.begin() + 1, args.end()));
+        return 0;
+    }
+
     ProgramState state;
     state.Init();
     state.Resize();
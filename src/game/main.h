@@ -27,9 +27,20 @@ extern Graphics::FrameBuffer framebuffer_map;
 
 extern GameUtils::AdaptiveViewport adaptive_viewport;
 extern Render r;
+extern SpriteRender sprite_render;
 
 extern Input::Mouse mouse;
 
+// The window and the graphics globals above are empty until those are called.
+// The game calls them at startup. The tests and the benchmarks only call them if they need them.
+
+// Creates the window and the GL context, if they don't exist yet. The tests and the benchmarks use a `hidden` window.
+void InitWindow(bool hidden = false);
+// Loads the fonts and the texture atlas, and creates the renderers, if that wasn't done yet. Calls `InitWindow()` if needed.
+void InitGraphics();
+
+extern ThreadPool thread_pool;
+
 STRUCT( GameState POLYMORPHIC EXTENDS GameUtils::State::Base )
 {
     virtual void Render() const = 0;
@@ -40,7 +40,40 @@ bool TileFlavors::ShouldMergeWith(Tile a, Tile b)
     return a == b;
 }
 
-const TileInfo GetTileInfo(Tile tile)
+// Which sub-tile of a `TileFlavors::Merged` tile to draw, for each merge mask (see `Map::GetMergeMask()`) and each of the 4 sub-quads.
+struct MergedSubTile
+{
+    ivec2 variant;
+    bool random_variant = false; // If true, `variant.x` should be chosen randomly.
+};
+static const auto merged_sub_tiles = []{
+    std::array<std::array<MergedSubTile, 4>, 256> ret{};
+    for (int mask = 0; mask < 256; mask++)
+    {
+        auto Merges = [&](ivec2 offset)
+        {
+            return bool(mask & Map::MergeMaskBit(offset));
+        };
+
+        for (ivec2 sub_pos : vector_range(ivec2(2)))
+        {
+            ivec2 offset = sub_pos * 2 - 1;
+            bool merge_h = Merges(offset with(y = 0));
+            bool merge_v = Merges(offset with(x = 0));
+            bool merge_hv = merge_h && merge_v && Merges(offset);
+
+            MergedSubTile &sub_tile = ret[mask][sub_pos.x + sub_pos.y * 2];
+            if      (merge_hv) sub_tile = {.variant = ivec2(0, 0), .random_variant = true};
+            else if (merge_h && merge_v) sub_tile.variant = ivec2(3, 1);
+            else if (merge_h ) sub_tile.variant = ivec2(1, 1);
+            else if (merge_v ) sub_tile.variant = ivec2(0, 1);
+            else               sub_tile.variant = ivec2(2, 1);
+        }
+    }
+    return ret;
+}();
+
+const TileInfo &GetTileInfo(Tile tile)
 {
     if (tile < Tile{} || tile >= Tile::_count)
         Program::Error(FMT("Invalid tile index: {}", int(tile)));
@@ -48,198 +81,685 @@ const TileInfo GetTileInfo(Tile tile)
     return tile_info_vec[int(tile)];
 }
 
-int Cell::CalcVisualCorruptionStage() const
+int Map::CellCorruption::CalcVisualStage() const
 {
-    if (corruption_stage == 0)
+    if (stage == 0)
         return 0;
-    // return clamp_min(clamp_max(visual_damage / corruption_stage_len, Cell::num_corruption_stages-1) - (Cell::num_corruption_stages - corruption_stage)) + 1;
-    return clamp_max(visual_damage / corruption_stage_len, corruption_stage-1) + 1;
+    // return clamp_min(clamp_max(visual_damage / corruption_stage_len, num_corruption_stages-1) - (num_corruption_stages - stage)) + 1;
+    return clamp_max(visual_damage / corruption_stage_len, stage-1) + 1;
+}
+
+void Map::Allocate(ivec2 size)
+{
+    tiles = decltype(tiles)(size);
+    randoms = decltype(randoms)(size);
+    solid_tiles = decltype(solid_tiles)(size);
+    corruption = decltype(corruption)(size);
+    chunks = decltype(chunks)((size + chunk_size - 1) / chunk_size);
+    chunk_meshes = decltype(chunk_meshes)(chunks.size());
+    merge_masks = decltype(merge_masks)(size);
+    active_cells.Reserve(tiles.element_count());
+}
+
+Map::Map(ivec2 size)
+{
+    Allocate(size);
+
+    for (auto pos : vector_range(size))
+        merge_masks.unsafe_at(pos) = ComputeMergeMask(pos);
 }
 
 Map::Map(Stream::Input source)
 {
-    Json json(source.ReadToMemory().string(), 64);
+    Stream::ReadOnlyData data = source.ReadToMemory();
+    Json json(data.string(), 64);
 
     auto layer_mid = Tiled::LoadTileLayer(Tiled::FindLayer(json, "mid"));
-    points = Tiled::LoadPointLayer(Tiled::FindLayer(json, "obj"));
 
-    cells = decltype(cells)(layer_mid.size());
+    Allocate(layer_mid.size());
+    points = Tiled::LoadPointLayer(Tiled::FindLayer(json, "obj"));
 
     for (auto pos : vector_range(layer_mid.size()))
     {
-        Cell &cell = cells.safe_nonthrowing_at(pos);
-
         int index = layer_mid.safe_throwing_at(pos);
         if (index < 0 || index >= int(Tile::_count))
             Program::Error(source.GetExceptionPrefix() + FMT("Invalid tile index {} at {}.", index, pos));
 
-        cell.tile = Tile(index);
-        cell.random = irand <= 255;
+        SetTileLow(pos, Tile(index));
+        randoms.unsafe_at(pos) = irand <= 255;
+    }
+
+    for (auto pos : vector_range(tiles.size()))
+        merge_masks.unsafe_at(pos) = ComputeMergeMask(pos);
+
+    random_seed = Hash::Bytes(data.data(), data.size());
+
+    if (points.GetSinglePointOpt("two_phase_corruption"))
+        two_phase_tick = true;
+}
+
+Map Map::Repeated(ivec2 size) const
+{
+    Map ret;
+    ret.Allocate(size);
+
+    for (auto pos : vector_range(size))
+    {
+        ivec2 source_pos = mod_ex(pos, tiles.size());
+        ret.SetTileLow(pos, tiles.unsafe_at(source_pos));
+        ret.randoms.unsafe_at(pos) = randoms.unsafe_at(source_pos);
     }
+    ret.random_seed = random_seed;
+
+    for (auto pos : vector_range(size))
+        ret.merge_masks.unsafe_at(pos) = ret.ComputeMergeMask(pos);
+
+    return ret;
 }
 
 void Map::Tick(ParticleController &par)
+{
+    Tick(par, thread_pool);
+}
+
+void Map::Tick(ParticleController &par, ThreadPool &pool)
 {
     time++;
 
-    for (ivec2 pos : vector_range(cells.size()))
+    if (two_phase_tick)
+        TickTwoPhase(par, pool);
+    else
+        TickSequential(par);
+}
+
+void Map::TickCell(ParticleController &par, int index)
+{
+    ivec2 pos = CellPos(index);
+    CellCorruption &cor = corruption.unsafe_at(pos);
+    if (cor.stage == 0)
+        return;
+
+    if (time - cor.start_time >= cor_spread_delay && cor.stage > 1)
     {
-        Cell &cell = cells.unsafe_at(pos);
-        if (cell.corruption_stage == 0)
-            continue;
+        for (int i = 0; i < 4; i++)
+            CorrputTile(pos + ivec2::dir4(i), cor.stage-1);
+    }
+
+    bool is_air = tiles.unsafe_at(pos) == Tile::air;
+
+    if (!is_air)
+    {
+        if (cor.visual_damage < 255)
+            cor.visual_damage++;
+
+
+        if (cor.stage >= cor_min_stage_to_explode)
+        {
+            cor.damage++;
+            int visual_stage = cor.CalcVisualStage();
+            if (visual_stage - cor_min_stage_to_explode >= (irand <= num_corruption_stages - cor_min_stage_to_explode))
+                par.AddSmallMapFlame(pos * tile_size + fvec2(frand <= tile_size, frand <= tile_size), fvec2(frand.abs() <= 0.2, -0.5 <= frand <= 0));
+        }
+    }
+
+    if (!is_air && cor.damage > cor_damage_to_explode)
+    {
+        SetTile(pos, Tile::air);
+        cor.stage = 0;
+        ChunkOf(pos).num_corrupted--;
+        active_cells.EraseUnordered(index);
+        for (int i = 0; i < 4; i++)
+            CorrputTile(pos + ivec2::dir4(i), num_corruption_stages);
+
+        if (play_sounds)
+            Sounds::block_explodes(pos * tile_size + tile_size / 2);
+
+        for (int i = 0; i < 5; i++)
+            par.AddMapFlame(pos * tile_size + fvec2(frand <= tile_size, frand <= tile_size), fvec2::dir(mrand.angle(), frand <= 1));
+    }
+}
 
-        if (time - cell.corruption_start_time >= cor_spread_delay && cell.corruption_stage > 1)
+void Map::TickSequential(ParticleController &par)
+{
+    // Visit the corrupted cells in the storage order, same as a full sweep would.
+    // Cells that get corrupted during the tick ahead of the current position are visited on the same tick, and the ones behind it are not.
+    tick_queue.resize(active_cells.ElemCount());
+    for (int i = 0; i < active_cells.ElemCount(); i++)
+        tick_queue[i] = active_cells.GetElem(i);
+    std::sort(tick_queue.begin(), tick_queue.end());
+    tick_queue_late.clear();
+
+    std::size_t queue_pos = 0;
+    while (queue_pos < tick_queue.size() || tick_queue_late.size() > 0)
+    {
+        if (tick_queue_late.empty() || (queue_pos < tick_queue.size() && tick_queue[queue_pos] < tick_queue_late.front()))
+        {
+            tick_cur_index = tick_queue[queue_pos++];
+        }
+        else
         {
-            for (int i = 0; i < 4; i++)
-                CorrputTile(pos + ivec2::dir4(i), cell.corruption_stage-1);
+            std::pop_heap(tick_queue_late.begin(), tick_queue_late.end(), std::greater{});
+            tick_cur_index = tick_queue_late.back();
+            tick_queue_late.pop_back();
         }
 
-        if (cell.tile != Tile::air)
+        TickCell(par, tick_cur_index);
+    }
+
+    tick_cur_index = -1;
+}
+
+void Map::TickFullSweep(ParticleController &par)
+{
+    time++;
+
+    for (int index = 0; index < int(tiles.element_count()); index++)
+        TickCell(par, index);
+}
+
+void Map::TickTwoPhase(ParticleController &par, ThreadPool &pool)
+{
+    tick_queue.resize(active_cells.ElemCount());
+    for (int i = 0; i < active_cells.ElemCount(); i++)
+        tick_queue[i] = active_cells.GetElem(i);
+    std::sort(tick_queue.begin(), tick_queue.end());
+
+    int num_bands = (tiles.size().y + two_phase_band_height - 1) / two_phase_band_height;
+    tick_bands.resize(num_bands);
+    for (int i = 0; i < num_bands; i++)
+    {
+        TickBand &band = tick_bands[i];
+        band.queue_begin = i == 0 ? 0 : tick_bands[i-1].queue_end;
+        band.queue_end = std::lower_bound(tick_queue.begin() + band.queue_begin, tick_queue.end(), (i + 1) * two_phase_band_height * tiles.size().x) - tick_queue.begin();
+    }
+
+    // Each band gets its own random number generator, so the results don't depend on the scheduling.
+    // The seeds only depend on the map state, so the results don't depend on the global random numbers either.
+    std::size_t seed = Hash::Combine(random_seed, std::size_t(time));
+
+    // Update the corrupted cells. Each band only modifies its own cells, and records how the corruption should spread.
+    pool.ForEachIndex(num_bands, [&](int band_index)
+    {
+        TickBand &band = tick_bands[band_index];
+        for (auto &list : band.corruption_requests)
+            list.clear();
+        band.exploded_cells.clear();
+        band.small_flames.clear();
+
+        if (band.queue_begin == band.queue_end)
+            return;
+
+        std::minstd_rand generator(Hash::Combine(seed, band_index));
+        Random::Scalar<int, std::minstd_rand> band_irand(generator);
+        Random::Scalar<float, std::minstd_rand> band_frand(generator);
+
+        auto RequestCorruption = [&](ivec2 target, int stage)
+        {
+            if (!tiles.pos_in_range(target))
+                return;
+            int target_band = target.y / two_phase_band_height - band_index;
+            band.corruption_requests[target_band + 1].emplace_back(target, stage);
+        };
+
+        for (std::size_t i = band.queue_begin; i < band.queue_end; i++)
         {
-            cell.visual_damage++;
+            int index = tick_queue[i];
+            ivec2 pos = CellPos(index);
+            CellCorruption &cor = corruption.unsafe_at(pos);
+
+            if (time - cor.start_time >= cor_spread_delay && cor.stage > 1)
+            {
+                for (int j = 0; j < 4; j++)
+                    RequestCorruption(pos + ivec2::dir4(j), cor.stage-1);
+            }
+
+            if (tiles.unsafe_at(pos) == Tile::air)
+                continue;
 
+            if (cor.visual_damage < 255)
+                cor.visual_damage++;
 
-            if (cell.corruption_stage >= cor_min_stage_to_explode)
+            if (cor.stage >= cor_min_stage_to_explode)
             {
-                cell.damage++;
-                int visual_stage = cell.CalcVisualCorruptionStage();
-                if (visual_stage - cor_min_stage_to_explode >= (irand <= Cell::num_corruption_stages - cor_min_stage_to_explode))
-                    par.AddSmallMapFlame(pos * tile_size + fvec2(frand <= tile_size, frand <= tile_size), fvec2(frand.abs() <= 0.2, -0.5 <= frand <= 0));
+                cor.damage++;
+                int visual_stage = cor.CalcVisualStage();
+                if (visual_stage - cor_min_stage_to_explode >= (band_irand <= num_corruption_stages - cor_min_stage_to_explode))
+                    band.small_flames.emplace_back(pos * tile_size + fvec2(band_frand <= tile_size, band_frand <= tile_size), fvec2(band_frand.abs() <= 0.2, -0.5 <= band_frand <= 0));
+            }
+
+            if (cor.damage > cor_damage_to_explode)
+            {
+                // The solidity bitmap rows are padded to whole words, so this doesn't touch the other bands.
+                // The merge masks can cross the band borders, so they're updated later.
+                SetTileLow(pos, Tile::air);
+                cor.stage = 0;
+                ChunkOf(pos).num_corrupted--;
+                band.exploded_cells.push_back(index);
+                for (int j = 0; j < 4; j++)
+                    RequestCorruption(pos + ivec2::dir4(j), num_corruption_stages);
             }
         }
+    });
 
-        if (cell.tile != Tile::air && cell.damage > cor_damage_to_explode)
+    // Spread the corruption. Each band applies the requests targeting its own cells.
+    pool.ForEachIndex(num_bands, [&](int band_index)
+    {
+        TickBand &band = tick_bands[band_index];
+        band.newly_corrupted_cells.clear();
+
+        for (int offset : {-1, 0, 1})
         {
-            cell.tile = Tile::air;
-            cell.corruption_stage = 0;
-            for (int i = 0; i < 4; i++)
-                CorrputTile(pos + ivec2::dir4(i), Cell::num_corruption_stages);
+            if (band_index + offset < 0 || band_index + offset >= num_bands)
+                continue;
 
-            Sounds::block_explodes(pos * tile_size + tile_size / 2);
+            for (const auto &[target, stage] : tick_bands[band_index + offset].corruption_requests[1 - offset])
+            {
+                if (CorruptTileLow(target, stage))
+                    band.newly_corrupted_cells.push_back(CellIndex(target));
+            }
+        }
+    });
+
+    // Merge the results, in a fixed order.
+    std::minstd_rand generator(Hash::Combine(seed, std::size_t(num_bands)));
+    Random::Scalar<float, std::minstd_rand> flame_frand(generator);
+    for (TickBand &band : tick_bands)
+    {
+        for (auto [pos, vel] : band.small_flames)
+            par.AddSmallMapFlame(pos, vel);
+
+        for (int index : band.exploded_cells)
+        {
+            ivec2 pos = CellPos(index);
+            active_cells.EraseUnordered(index);
+            UpdateMergeMasksAround(pos);
+
+            if (play_sounds)
+                Sounds::block_explodes(pos * tile_size + tile_size / 2);
 
             for (int i = 0; i < 5; i++)
-                par.AddMapFlame(pos * tile_size + fvec2(frand <= tile_size, frand <= tile_size), fvec2::dir(mrand.angle(), frand <= 1));
+                par.AddMapFlame(pos * tile_size + fvec2(flame_frand <= tile_size, flame_frand <= tile_size), fvec2::dir(flame_frand.abs() <= f_pi, flame_frand <= 1));
         }
+
+        for (int index : band.newly_corrupted_cells)
+            active_cells.Insert(index);
     }
 }
 
-void Map::Render(ivec2 camera_pos) const
+bool Map::GetVisibleTiles(ivec2 camera_pos, ivec2 &a, ivec2 &b) const
 {
-    static const Graphics::TextureAtlas::Region tiles_tex = texture_atlas.Get("tiles.png");
+    a = clamp_min(div_ex(camera_pos - screen_size/2, tile_size), 0);
+    b = clamp_max(div_ex(camera_pos + screen_size/2, tile_size), tiles.size() - 1);
+    return (a <= b).all();
+}
 
-    ivec2 a = div_ex(camera_pos - screen_size/2, tile_size);
-    ivec2 b = div_ex(camera_pos + screen_size/2, tile_size);
+void Map::BuildChunkMesh(ivec2 chunk_pos, ChunkMesh &mesh) const
+{
+    mesh.quads.clear();
 
-    for (ivec2 tile_pos : a <= vector_range <= b)
+    ivec2 a = chunk_pos * chunk_size;
+    ivec2 b = min(a + chunk_size, tiles.size());
+
+    for (int y = a.y; y < b.y; y++)
     {
-        if (!cells.pos_in_range(tile_pos))
-            continue;
+        mesh.row_begin[y - a.y] = mesh.quads.size();
 
-        ivec2 tile_pixel_pos = tile_pos * tile_size - camera_pos;
+        for (int x = a.x; x < b.x; x++)
+        {
+            ivec2 tile_pos(x, y);
+            ivec2 tile_pixel_pos = tile_pos * tile_size;
 
-        const Cell &cell = cells.unsafe_at(tile_pos);
-        const TileInfo &tile_info = GetTileInfo(cell.tile);
+            Tile tile = tiles.unsafe_at(tile_pos);
+            std::uint8_t random = randoms.unsafe_at(tile_pos);
+            std::uint8_t merge_mask = merge_masks.unsafe_at(tile_pos);
+            const TileInfo &tile_info = GetTileInfo(tile);
 
-        std::visit(Meta::overload{
-            [](const TileFlavors::Invis &) {},
-            [&](const TileFlavors::Random &flavor)
+            auto AddQuad = [&](ivec2 pos, ivec2 tex_pos, ivec2 size)
             {
-                r.iquad(tile_pixel_pos, tiles_tex.region(ivec2(cell.random % flavor.count, flavor.index) * tile_size, ivec2(tile_size)));
-            },
-            [&](const TileFlavors::Merged &flavor)
-            {
-                int rand_index = std::array{0,0,0,0,1,1,2,3}[cell.random % 8];
+                mesh.quads.push_back({.pos = pos, .tex_pos = tex_pos, .size = size});
+            };
 
-                for (ivec2 sub_pos : vector_range(ivec2(2)))
+            std::visit(Meta::overload{
+                [](const TileFlavors::Invis &) {},
+                [&](const TileFlavors::Random &flavor)
                 {
-                    ivec2 offset = sub_pos * 2 - 1;
-                    bool merge_h = TileFlavors::ShouldMergeWith(cell.tile, cells.clamped_at(tile_pos + offset with(y = 0)).tile);
-                    bool merge_v = TileFlavors::ShouldMergeWith(cell.tile, cells.clamped_at(tile_pos + offset with(x = 0)).tile);
-                    bool merge_hv = merge_h && merge_v && TileFlavors::ShouldMergeWith(cell.tile, cells.clamped_at(tile_pos + offset).tile);
-
-                    ivec2 variant;
-                    if      (merge_hv) variant = ivec2(rand_index, 0);
-                    else if (merge_h && merge_v) variant = ivec2(3, 1);
-                    else if (merge_h ) variant = ivec2(1, 1);
-                    else if (merge_v ) variant = ivec2(0, 1);
-                    else               variant = ivec2(2, 1);
-
-                    ivec2 pixel_sub_pos = sub_pos * tile_size / 2;
-
-                    r.iquad(tile_pixel_pos + pixel_sub_pos, tiles_tex.region((ivec2(0, flavor.index) + variant) * tile_size + pixel_sub_pos, ivec2(tile_size / 2)));
-                }
-            },
-            [&](const TileFlavors::HorMergedWithRandom &flavor)
-            {
-                bool merge_l = TileFlavors::ShouldMergeWith(cell.tile, cells.clamped_at(tile_pos with(x -= 1)).tile);
-                bool merge_r = TileFlavors::ShouldMergeWith(cell.tile, cells.clamped_at(tile_pos with(x += 1)).tile);
-
-                if (merge_l && merge_r)
+                    AddQuad(tile_pixel_pos, ivec2(random % flavor.count, flavor.index) * tile_size, ivec2(tile_size));
+                },
+                [&](const TileFlavors::Merged &flavor)
                 {
-                    r.iquad(tile_pixel_pos, tiles_tex.region(ivec2(cell.random % flavor.rand_count + 1, flavor.index) * tile_size, ivec2(tile_size)));
-                }
-                else
+                    int rand_index = std::array{0,0,0,0,1,1,2,3}[random % 8];
+
+                    for (ivec2 sub_pos : vector_range(ivec2(2)))
+                    {
+                        const MergedSubTile &sub_tile = merged_sub_tiles[merge_mask][sub_pos.x + sub_pos.y * 2];
+                        ivec2 variant = sub_tile.variant;
+                        if (sub_tile.random_variant)
+                            variant.x = rand_index;
+
+                        ivec2 pixel_sub_pos = sub_pos * tile_size / 2;
+
+                        AddQuad(tile_pixel_pos + pixel_sub_pos, (ivec2(0, flavor.index) + variant) * tile_size + pixel_sub_pos, ivec2(tile_size / 2));
+                    }
+                },
+                [&](const TileFlavors::HorMergedWithRandom &flavor)
                 {
-                    r.iquad(tile_pixel_pos, tiles_tex.region(ivec2(merge_l, flavor.index) * tile_size, ivec2(tile_size) with(x /= 2)));
-                    r.iquad(tile_pixel_pos with(x += tile_size/2), tiles_tex.region(ivec2(merge_r, flavor.index) * tile_size + ivec2(tile_size/2, 0), ivec2(tile_size) with(x /= 2)));
-                }
-            },
-        }, tile_info.vis);
+                    bool merge_l = merge_mask & MergeMaskBit(ivec2(-1, 0));
+                    bool merge_r = merge_mask & MergeMaskBit(ivec2(1, 0));
+
+                    if (merge_l && merge_r)
+                    {
+                        AddQuad(tile_pixel_pos, ivec2(random % flavor.rand_count + 1, flavor.index) * tile_size, ivec2(tile_size));
+                    }
+                    else
+                    {
+                        AddQuad(tile_pixel_pos, ivec2(merge_l, flavor.index) * tile_size, ivec2(tile_size) with(x /= 2));
+                        AddQuad(tile_pixel_pos with(x += tile_size/2), ivec2(merge_r, flavor.index) * tile_size + ivec2(tile_size/2, 0), ivec2(tile_size) with(x /= 2));
+                    }
+                },
+            }, tile_info.vis);
+        }
     }
+
+    for (int y = b.y - a.y; y <= chunk_size; y++)
+        mesh.row_begin[y] = mesh.quads.size();
+
+    for (ivec2 offset : vector_range(ivec2(3)))
+    {
+        ivec2 neighbor_pos = chunk_pos + offset - 1;
+        mesh.source_versions[offset.x + offset.y * 3] = chunks.pos_in_range(neighbor_pos) ? chunks.unsafe_at(neighbor_pos).geometry_version : 0;
+    }
+    mesh.valid = true;
 }
 
-void Map::RenderCorruption(ivec2 camera_pos) const
+bool Map::ChunkMeshIsUpToDate(ivec2 chunk_pos, const ChunkMesh &mesh) const
+{
+    if (!mesh.valid)
+        return false;
+
+    for (ivec2 offset : vector_range(ivec2(3)))
+    {
+        ivec2 neighbor_pos = chunk_pos + offset - 1;
+        if (chunks.pos_in_range(neighbor_pos) && chunks.unsafe_at(neighbor_pos).geometry_version != mesh.source_versions[offset.x + offset.y * 3])
+            return false;
+    }
+    return true;
+}
+
+void Map::Render(ivec2 camera_pos) const
 {
-    static const Graphics::TextureAtlas::Region corruption_tex = texture_atlas.Get("corruption.png");
+    const Graphics::TextureAtlas::Region tiles_tex = texture_atlas.Get<"tiles.png">();
+
+    ivec2 a, b;
+    if (!GetVisibleTiles(camera_pos, a, b))
+        return;
 
-    ivec2 a = div_ex(camera_pos - screen_size/2, tile_size);
-    ivec2 b = div_ex(camera_pos + screen_size/2, tile_size);
+    stale_chunks.clear();
+    for (ivec2 chunk_pos : a / chunk_size <= vector_range <= b / chunk_size)
+    {
+        if (chunks.unsafe_at(chunk_pos).num_drawn > 0 && !ChunkMeshIsUpToDate(chunk_pos, chunk_meshes.unsafe_at(chunk_pos)))
+            stale_chunks.push_back(chunk_pos);
+    }
 
-    for (ivec2 tile_pos : a <= vector_range <= b)
+    // Each chunk only touches its own mesh, so they can be rebuilt in parallel.
+    thread_pool.ForEachIndex(stale_chunks.size(), [&](int index)
     {
-        if (!cells.pos_in_range(tile_pos))
-            continue;
+        ivec2 chunk_pos = stale_chunks[index];
+        BuildChunkMesh(chunk_pos, chunk_meshes.unsafe_at(chunk_pos));
+    });
+
+    for (ivec2 chunk_pos : a / chunk_size <= vector_range <= b / chunk_size)
+    {
+        if (chunks.unsafe_at(chunk_pos).num_drawn == 0)
+            continue; // Nothing to draw.
+
+        const ChunkMesh &mesh = chunk_meshes.unsafe_at(chunk_pos);
+
+        // Only submit the visible rows.
+        int row_a = clamp_min(a.y - chunk_pos.y * chunk_size, 0);
+        int row_b = clamp_max(b.y - chunk_pos.y * chunk_size + 1, chunk_size);
+
+        // And the visible columns, if the chunk is cut off at the sides of the screen.
+        bool clip_left = a.x > chunk_pos.x * chunk_size;
+        bool clip_right = b.x < chunk_pos.x * chunk_size + chunk_size - 1;
+
+        for (int row = row_a; row < row_b; row++)
+        {
+            auto begin = mesh.quads.begin() + mesh.row_begin[row];
+            auto end = mesh.quads.begin() + mesh.row_begin[row + 1];
+
+            // The quads in a row are sorted by the tile column.
+            if (clip_left)
+                begin = std::partition_point(begin, end, [&](const ChunkMesh::Quad &quad){return quad.pos.x / tile_size < a.x;});
+            if (clip_right)
+                end = std::partition_point(begin, end, [&](const ChunkMesh::Quad &quad){return quad.pos.x / tile_size <= b.x;});
+
+            for (auto it = begin; it != end; it++)
+                r.iquad(it->pos - camera_pos, tiles_tex.region(it->tex_pos, it->size));
+        }
+    }
+}
 
-        ivec2 tile_pixel_pos = tile_pos * tile_size - camera_pos;
+void Map::RenderCorruption(ivec2 camera_pos) const
+{
+    const Graphics::TextureAtlas::Region corruption_tex = texture_atlas.Get<"corruption.png">();
 
-        const Cell &cell = cells.unsafe_at(tile_pos);
+    ivec2 a, b;
+    if (!GetVisibleTiles(camera_pos, a, b))
+        return;
 
-        if (cell.corruption_stage == 0)
+    for (ivec2 chunk_pos : a / chunk_size <= vector_range <= b / chunk_size)
+    {
+        if (chunks.unsafe_at(chunk_pos).num_corrupted == 0)
             continue; // Not corrupted.
 
-        int visual_stage = cell.CalcVisualCorruptionStage() - 1;
-        if (visual_stage >= 0)
-            r.iquad(tile_pixel_pos, corruption_tex.region(ivec2(visual_stage * tile_size, 0), ivec2(tile_size)));
-        // r.itext(tile_pixel_pos + tile_size/2, Graphics::Text(Fonts::main, FMT("{}", cell.corruption_stage)));
+        for (ivec2 tile_pos : max(a, chunk_pos * chunk_size) <= vector_range <= min(b, chunk_pos * chunk_size + chunk_size - 1))
+        {
+            ivec2 tile_pixel_pos = tile_pos * tile_size - camera_pos;
+
+            const CellCorruption &cor = corruption.unsafe_at(tile_pos);
+
+            if (cor.stage == 0)
+                continue; // Not corrupted.
+
+            int visual_stage = cor.CalcVisualStage() - 1;
+            if (visual_stage >= 0)
+                r.iquad(tile_pixel_pos, corruption_tex.region(ivec2(visual_stage * tile_size, 0), ivec2(tile_size)));
+            // r.itext(tile_pixel_pos + tile_size/2, Graphics::Text(Fonts::main, FMT("{}", cor.stage)));
+        }
+    }
+}
+
+void Map::SetTile(ivec2 tile_pos, Tile tile)
+{
+    SetTileLow(tile_pos, tile);
+    UpdateMergeMasksAround(tile_pos);
+}
+
+void Map::SetTileLow(ivec2 tile_pos, Tile tile)
+{
+    Tile &old_tile = tiles.safe_nonthrowing_at(tile_pos);
+    if (old_tile == tile)
+        return;
+
+    const TileInfo &old_info = GetTileInfo(old_tile);
+    const TileInfo &new_info = GetTileInfo(tile);
+    old_tile = tile;
+    solid_tiles.unsafe_set(tile_pos, new_info.solid);
+
+    Chunk &chunk = ChunkOf(tile_pos);
+    chunk.num_solid += new_info.solid - old_info.solid;
+    chunk.num_drawn += !std::holds_alternative<TileFlavors::Invis>(new_info.vis) - !std::holds_alternative<TileFlavors::Invis>(old_info.vis);
+    chunk.geometry_version++;
+}
+
+std::uint8_t Map::ComputeMergeMask(ivec2 tile_pos) const
+{
+    Tile tile = tiles.unsafe_at(tile_pos);
+    std::uint8_t ret = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        if (TileFlavors::ShouldMergeWith(tile, tiles.clamped_at(tile_pos + ivec2::dir8(i))))
+            ret |= 1 << i;
     }
+    return ret;
+}
+
+void Map::UpdateMergeMasksAround(ivec2 tile_pos)
+{
+    for (ivec2 pos : clamp_min(tile_pos - 1, 0) <= vector_range <= clamp_max(tile_pos + 1, tiles.size() - 1))
+        merge_masks.unsafe_at(pos) = ComputeMergeMask(pos);
 }
 
 bool Map::PixelIsSolid(ivec2 pos) const
 {
-    ivec2 tile_pos = div_ex(pos, tile_size);
-    if (!cells.pos_in_range(tile_pos))
-        return false;
-    return GetTileInfo(cells.safe_nonthrowing_at(tile_pos).tile).solid;
+    return solid_tiles.try_get(div_ex(pos, tile_size));
 }
 
-void Map::CorrputTile(ivec2 tile_pos, int stage)
+bool Map::AnyPixelSolidInRect(ivec2 a, ivec2 b) const
+{
+    return solid_tiles.any_in_rect(div_ex(a, tile_size), div_ex(b, tile_size) + 1);
+}
+
+bool Map::AnyPixelSolidInRow(int y, int x_a, int x_b) const
+{
+    return solid_tiles.any_in_row_span(div_ex(y, tile_size), div_ex(x_a, tile_size), div_ex(x_b, tile_size) + 1);
+}
+
+int Map::RectFreeDistance(ivec2 a, ivec2 b, int axis, int dir, int max_dist) const
+{
+    if (max_dist <= 0)
+        return 0;
+
+    int other_axis = 1 - axis;
+
+    // The tiles covered along the other axis don't change during the movement.
+    ivec2 line_a, line_b;
+    line_a[other_axis] = div_ex(a[other_axis], tile_size);
+    line_b[other_axis] = div_ex(b[other_axis], tile_size) + 1;
+
+    int leading_edge = dir > 0 ? b[axis] : a[axis];
+    int trailing_edge = dir > 0 ? a[axis] : b[axis];
+
+    // The tile rows/columns we can touch, from the nearest one to the farthest.
+    int first_line = div_ex(trailing_edge + dir, tile_size);
+    int last_line = div_ex(leading_edge + dir * max_dist, tile_size);
+    // The rectangle covers all lines up to this one after moving by one pixel.
+    int first_step_line = div_ex(leading_edge + dir, tile_size);
+
+    for (int line = first_line; line != last_line + dir; line += dir)
+    {
+        line_a[axis] = line;
+        line_b[axis] = line + 1;
+        if (!solid_tiles.any_in_rect(line_a, line_b))
+            continue;
+
+        if ((line - first_step_line) * dir <= 0)
+            return 0; // Blocked right away.
+
+        // Stop right before the leading edge enters this line.
+        int line_edge = dir > 0 ? line * tile_size : line * tile_size + tile_size - 1;
+        return (line_edge - leading_edge) * dir - 1;
+    }
+
+    return max_dist;
+}
+
+ivec2 Map::MoveRect(ivec2 &pos, ivec2 int_vel, ivec2 a, ivec2 b) const
+{
+    ivec2 blocked{};
+    ivec2 dir = sign(int_vel);
+
+    // Returns how many positions, starting from the current one, the span `[coord_a, coord_b]` covers the same tiles when moving in direction `dir`.
+    auto PositionsInSameTiles = [](int coord_a, int coord_b, int dir)
+    {
+        if (dir > 0)
+            return min(tile_size - mod_ex(coord_a, tile_size), tile_size - mod_ex(coord_b, tile_size));
+        else
+            return min(mod_ex(coord_a, tile_size), mod_ex(coord_b, tile_size)) + 1;
+    };
+
+    // While both axes move, the movement alternates between them a pixel at a time, starting with X.
+    while (int_vel.x != 0 && int_vel.y != 0)
+    {
+        if (AnyPixelSolidInRect(pos + a + ivec2(dir.x, 0), pos + b + ivec2(dir.x, 0)))
+        {
+            blocked.x = dir.x;
+            int_vel.x = 0;
+            break;
+        }
+        if (AnyPixelSolidInRect(pos + a + dir, pos + b + dir))
+        {
+            pos.x += dir.x;
+            int_vel.x -= dir.x;
+            blocked.y = dir.y;
+            int_vel.y = 0;
+            break;
+        }
+
+        // Both steps succeeded. The next steps test the same tiles until the rectangle crosses a tile boundary, so they succeed too.
+        int steps = min(
+            PositionsInSameTiles(pos.x + dir.x + a.x, pos.x + dir.x + b.x, dir.x),
+            PositionsInSameTiles(pos.y + a.y, pos.y + b.y, dir.y),
+            PositionsInSameTiles(pos.y + dir.y + a.y, pos.y + dir.y + b.y, dir.y)
+        );
+        clamp_var_max(steps, min(abs(int_vel.x), abs(int_vel.y)));
+        pos += dir * steps;
+        int_vel -= dir * steps;
+    }
+
+    // The rest of the movement is along a single axis.
+    for (int i : {0, 1})
+    {
+        if (int_vel[i] == 0)
+            continue;
+
+        int dist = RectFreeDistance(pos + a, pos + b, i, dir[i], abs(int_vel[i]));
+        pos[i] += dir[i] * dist;
+        if (dist < abs(int_vel[i]))
+            blocked[i] = dir[i];
+    }
+
+    return blocked;
+}
+
+bool Map::CorruptTileLow(ivec2 tile_pos, int stage)
 {
     if (stage <= 0)
-        return;
-    clamp_var(stage, 0, Cell::num_corruption_stages);
+        return false;
+    clamp_var(stage, 0, num_corruption_stages);
 
-    if (!cells.pos_in_range(tile_pos))
-        return; // Tile coords out of range.
+    if (!corruption.pos_in_range(tile_pos))
+        return false; // Tile coords out of range.
 
-    Cell &cell = cells.safe_nonthrowing_at(tile_pos);
-    if (cell.corruption_stage > stage)
-        return; // Already corrupted to a greater degree.
+    CellCorruption &cor = corruption.unsafe_at(tile_pos);
+    if (cor.stage > stage)
+        return false; // Already corrupted to a greater degree.
+
+    if (!GetTileInfo(tiles.unsafe_at(tile_pos)).corruptable)
+        return false; // Not corruptable.
+
+    bool was_corrupted = cor.stage != 0;
+    if (!was_corrupted)
+    {
+        cor.start_time = time;
+        ChunkOf(tile_pos).num_corrupted++;
+    }
 
-    if (!GetTileInfo(cell.tile).corruptable)
-        return; // Not corruptable.
+    cor.stage = stage;
+    return !was_corrupted;
+}
 
-    if (cell.corruption_stage == 0)
-        cell.corruption_start_time = time;
+void Map::CorrputTile(ivec2 tile_pos, int stage)
+{
+    if (!CorruptTileLow(tile_pos, stage))
+        return;
 
-    cell.corruption_stage = stage;
+    int index = CellIndex(tile_pos);
+    active_cells.Insert(index);
+    if (index > tick_cur_index && tick_cur_index != -1)
+    {
+        // Got corrupted during `Tick()` ahead of the current position, so it must be visited on this tick too.
+        tick_queue_late.push_back(index);
+        std::push_heap(tick_queue_late.begin(), tick_queue_late.end(), std::greater{});
+    }
 }
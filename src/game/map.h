@@ -1,11 +1,14 @@
 #pragma once
 #include "gameutils/tiled_map.h"
+#include "utils/bit_array_2d.h"
+#include "utils/sparse_set.h"
 
 class ParticleController;
+class ThreadPool;
 
 inline constexpr int tile_size = 12;
 
-enum class Tile
+enum class Tile : std::uint8_t
 {
     air,
     wall,
@@ -50,42 +53,256 @@ struct TileInfo
     bool corruptable = false;
     TileDrawMethod vis;
 };
-[[nodiscard]] const TileInfo GetTileInfo(Tile tile);
+[[nodiscard]] const TileInfo &GetTileInfo(Tile tile);
 
-struct Cell
+class Map
 {
-    Tile tile;
-    std::uint8_t random = 0;
-
+  public:
     static constexpr int
         num_corruption_stages = 6,
         corruption_stage_len = 15;
 
-    int corruption_stage = 0; // 0..num_corruption_stages
-    int corruption_start_time = 0; // Relative to `Map::Time()`.
-    int damage = 0;
-    int visual_damage = 0;
+    struct CellCorruption
+    {
+        int start_time = 0; // Relative to `Map::Time()`.
+        std::uint8_t stage = 0; // 0..num_corruption_stages
+        std::uint8_t damage = 0;
+        std::uint8_t visual_damage = 0; // Saturates, `CalcVisualStage()` stops caring about it long before that.
 
-    [[nodiscard]] int CalcVisualCorruptionStage() const;
-};
+        [[nodiscard]] int CalcVisualStage() const;
+    };
 
-class Map
-{
+    // The map is split into square chunks of this size (in tiles), each tracking a summary of its contents.
+    // This lets the rendering skip the chunks that have nothing to draw.
+    static constexpr int chunk_size = 32;
+
+    struct Chunk
+    {
+        int num_corrupted = 0; // Cells with non-zero corruption stage. Chunks without them are asleep and aren't visited by `Tick()`.
+        int num_solid = 0; // Tiles with `TileInfo::solid`.
+        int num_drawn = 0; // Tiles not using `TileFlavors::Invis`.
+        std::uint32_t geometry_version = 0; // Incremented every time a tile in this chunk changes. Compare with a saved value to check if the chunk changed since then.
+    };
+
+  private:
     int time = 1; // `0` is reserved for "never".
+
+    // The cells are stored as separate planes, so each consumer only touches the bytes it needs.
+    Array2D<Tile> tiles;
+    Array2D<std::uint8_t> randoms;
+    BitArray2D solid_tiles; // Mirrors `GetTileInfo(...).solid` for `tiles`. Maintained by `SetTile()`.
+    Array2D<CellCorruption> corruption;
+
+    // For each tile, bit `i` is set if it should merge with the neighbor at `ivec2::dir8(i)`, see `TileFlavors::ShouldMergeWith()`.
+    // The out-of-range neighbors are clamped to the map bounds. Maintained by `SetTile()`.
+    Array2D<std::uint8_t> merge_masks;
+
+    Array2D<Chunk> chunks; // Maintained by `SetTile()` and the functions that change the corruption stage.
+
+    // The tile quads of a chunk, with the autotiling already resolved. Built lazily by `Render()`.
+    struct ChunkMesh
+    {
+        struct Quad
+        {
+            ivec2 pos; // In pixels, relative to the map origin.
+            ivec2 tex_pos; // Relative to `tiles.png`.
+            ivec2 size;
+        };
+        std::vector<Quad> quads; // Sorted by the tile row, then by the tile column.
+        std::array<int, chunk_size + 1> row_begin{}; // Indices in `quads` where each tile row of the chunk begins.
+        std::array<std::uint32_t, 9> source_versions{}; // `Chunk::geometry_version` of this chunk and its neighbors, when the mesh was built.
+        bool valid = false;
+    };
+    mutable Array2D<ChunkMesh> chunk_meshes;
+    mutable std::vector<ivec2> stale_chunks; // Only used during `Render()`. It's a member only to reuse the memory.
+
+    // Indices (as in `tiles.elements()`) of the cells with non-zero corruption stage. Only those are visited by `Tick()`.
+    SparseSet<int> active_cells;
+    // Those are only used during `Tick()`. They're members only to reuse the memory.
+    std::vector<int> tick_queue; // A sorted copy of `active_cells`.
+    std::vector<int> tick_queue_late; // A min-heap of cells corrupted during the tick ahead of the current position.
+    int tick_cur_index = -1; // The cell currently processed by `Tick()`, or -1 outside of `Tick()`.
+
+    // The per-band state of `TickTwoPhase()`. Each band is `two_phase_band_height` rows tall.
+    // The bands are aligned to the chunks, so each chunk is only modified by one band.
+    struct TickBand
+    {
+        std::size_t queue_begin = 0, queue_end = 0; // The cells of this band in `tick_queue`.
+        std::array<std::vector<std::pair<ivec2, int>>, 3> corruption_requests; // Pairs of position and stage, targeting the band above, this band, and the band below.
+        std::vector<int> exploded_cells;
+        std::vector<int> newly_corrupted_cells;
+        std::vector<std::pair<fvec2, fvec2>> small_flames; // Pairs of position and velocity.
+    };
+    std::vector<TickBand> tick_bands;
+
+    // Combined with `time` to seed the random numbers of `TickTwoPhase()`, so its results only depend on the map state.
+    // Derived from the level file, so loading a level doesn't consume the global random numbers.
+    std::size_t random_seed = 0;
+
+    // Allocates the planes for a map of this size, filled with air. Doesn't compute the merge masks.
+    void Allocate(ivec2 size);
+
+    // Updates a single corrupted cell, as a part of `TickSequential()` or `TickFullSweep()`.
+    void TickCell(ParticleController &par, int index);
+
+    void TickSequential(ParticleController &par);
+    void TickTwoPhase(ParticleController &par, ThreadPool &pool);
+
+    // Same as `SetTile()`, but doesn't update the merge masks.
+    void SetTileLow(ivec2 tile_pos, Tile tile);
+    [[nodiscard]] std::uint8_t ComputeMergeMask(ivec2 tile_pos) const;
+    // Recomputes the merge masks that could depend on this tile.
+    void UpdateMergeMasksAround(ivec2 tile_pos);
+
+    // Returns true if the cell wasn't corrupted before. Doesn't update `active_cells`.
+    bool CorruptTileLow(ivec2 tile_pos, int stage);
+
+    [[nodiscard]] int CellIndex(ivec2 tile_pos) const
+    {
+        return tile_pos.x + tile_pos.y * tiles.size().x;
+    }
+    [[nodiscard]] ivec2 CellPos(int index) const
+    {
+        return ivec2(index % tiles.size().x, index / tiles.size().x);
+    }
+
+    // Expects the position to be in range.
+    [[nodiscard]] Chunk &ChunkOf(ivec2 tile_pos)
+    {
+        return chunks.unsafe_at(tile_pos / chunk_size);
+    }
+
+    // The autotiling depends on the neighboring tiles, so the mesh is also rebuilt when any of the neighboring chunks change.
+    [[nodiscard]] bool ChunkMeshIsUpToDate(ivec2 chunk_pos, const ChunkMesh &mesh) const;
+    void BuildChunkMesh(ivec2 chunk_pos, ChunkMesh &mesh) const;
+
+    // Computes the range of tiles visible from `camera_pos`, clamped to the map bounds. Both bounds are inclusive.
+    // Returns false if nothing is visible.
+    [[nodiscard]] bool GetVisibleTiles(ivec2 camera_pos, ivec2 &a, ivec2 &b) const;
+
   public:
-    Array2D<Cell> cells;
+    static constexpr int two_phase_band_height = chunk_size;
+
     Tiled::PointLayer points;
 
+    // If true, `Tick()` first updates the corrupted cells based on the old state, and then applies the spread of the corruption as a separate step.
+    // Both steps process the map in bands of rows in parallel.
+    // The results are different from the default mode: the newly corrupted cells are processed starting from the next tick, regardless of their position,
+    //   so the individual cells can explode a few ticks earlier or later. The same tiles end up destroyed once the corruption burns out.
+    // Off by default. The levels enable it with the `two_phase_corruption` point.
+    bool two_phase_tick = false;
+
+    // If false, `Tick()` doesn't play sounds. The benchmarks and tests disable this.
+    bool play_sounds = true;
+
     Map() {}
+    // Creates an empty map of the given size (in tiles), filled with air.
+    Map(ivec2 size);
     Map(Stream::Input source);
 
+    // Returns a map of the given size, filled by repeating the tiles of this one. The points are not copied.
+    // This is used by the benchmarks and tests to make maps larger than any level.
+    [[nodiscard]] Map Repeated(ivec2 size) const;
+
     void Tick(ParticleController &par);
+    // Same, but runs `TickTwoPhase()` on the specified thread pool.
+    void Tick(ParticleController &par, ThreadPool &pool);
+    // Same as `Tick()` without `two_phase_tick`, but visits every cell of the map instead of only the corrupted ones, like it was done originally.
+    // This is slow, it's only used by the tests as a reference.
+    void TickFullSweep(ParticleController &par);
     void Render(ivec2 camera_pos) const;
     void RenderCorruption(ivec2 camera_pos) const;
 
     [[nodiscard]] int Time() const {return time;}
 
+    // Size in tiles.
+    [[nodiscard]] ivec2 Size() const {return tiles.size();}
+    [[nodiscard]] bool PosInRange(ivec2 tile_pos) const {return tiles.pos_in_range(tile_pos);}
+
+    // Those expect the position to be in range.
+    [[nodiscard]] Tile GetTile(ivec2 tile_pos) const {return tiles.unsafe_at(tile_pos);}
+    [[nodiscard]] std::uint8_t GetRandom(ivec2 tile_pos) const {return randoms.unsafe_at(tile_pos);}
+    [[nodiscard]] const CellCorruption &GetCorruption(ivec2 tile_pos) const {return corruption.unsafe_at(tile_pos);}
+
+    // Also updates the solidity plane, the merge masks and the chunk summary.
+    void SetTile(ivec2 tile_pos, Tile tile);
+
+    // See `merge_masks`.
+    [[nodiscard]] static constexpr std::uint8_t MergeMaskBit(ivec2 offset)
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            if (ivec2::dir8(i) == offset)
+                return 1 << i;
+        }
+        return 0;
+    }
+    // Expects the position to be in range.
+    [[nodiscard]] std::uint8_t GetMergeMask(ivec2 tile_pos) const {return merge_masks.unsafe_at(tile_pos);}
+
+    // The size of the chunk grid.
+    [[nodiscard]] ivec2 ChunkGridSize() const {return chunks.size();}
+    // Expects the chunk position to be in range.
+    [[nodiscard]] const Chunk &GetChunk(ivec2 chunk_pos) const {return chunks.unsafe_at(chunk_pos);}
+
+    // Returns false if out of range.
+    [[nodiscard]] bool TileIsSolid(ivec2 tile_pos) const {return solid_tiles.try_get(tile_pos);}
     [[nodiscard]] bool PixelIsSolid(ivec2 pos) const;
+    // Returns true if any pixel in the rectangle `[a, b]` (note the inclusive upper bound) is solid.
+    // Tests a tile row at a time, a machine word at a time.
+    [[nodiscard]] bool AnyPixelSolidInRect(ivec2 a, ivec2 b) const;
+    // Returns true if any pixel in the horizontal span `[x_a, x_b]` of pixel row `y` is solid.
+    [[nodiscard]] bool AnyPixelSolidInRow(int y, int x_a, int x_b) const;
+    // Returns how far (in pixels, at most `max_dist`) the rectangle `[a, b]` can move along `axis` in direction `dir` (+1 or -1) without overlapping solid tiles.
+    // Same as moving it one pixel at a time and testing `AnyPixelSolidInRect()` at each step, but visits each crossed tile row/column only once.
+    [[nodiscard]] int RectFreeDistance(ivec2 a, ivec2 b, int axis, int dir, int max_dist) const;
+    // Moves the rectangle `[pos + a, pos + b]` by `int_vel` against the solid tiles. Same results as `SweepMove()` with `RectFreeDistance()`.
+    // When moving diagonally, `SweepMove()` alternates between the axes a pixel at a time, recomputing the free distance after each step.
+    // This function instead skips ahead until the rectangle crosses a tile boundary, since the collisions can't change before that.
+    [[nodiscard]] ivec2 MoveRect(ivec2 &pos, ivec2 int_vel, ivec2 a, ivec2 b) const;
 
     void CorrputTile(ivec2 tile_pos, int stage);
 };
+
+// Moves `pos` by `int_vel`, same as moving it one pixel at a time while alternating between the axes,
+// and stopping the movement along an axis as soon as the next pixel along it is blocked.
+// `free_distance(pos, axis, dir, max_dist)` must return how far (at most `max_dist`) the object can move from `pos` along `axis` in direction `dir` (+1 or -1).
+// Returns the direction in which each axis was blocked, or 0 if it wasn't.
+template <typename F>
+[[nodiscard]] ivec2 SweepMove(ivec2 &pos, ivec2 int_vel, F &&free_distance)
+{
+    ivec2 blocked{};
+    ivec2 free(-1); // How far we can move along each axis from the current position, or -1 if unknown.
+
+    while (int_vel)
+    {
+        for (int i : {0, 1})
+        {
+            if (int_vel[i] == 0)
+                continue;
+
+            int s = sign(int_vel[i]);
+
+            if (free[i] < 0)
+                free[i] = free_distance(std::as_const(pos), i, s, abs(int_vel[i]));
+
+            if (free[i] == 0)
+            {
+                int_vel[i] = 0;
+                blocked[i] = s;
+                continue;
+            }
+
+            // If the other axis is done moving, move all at once. Otherwise move by one pixel, to alternate between the axes.
+            int step = int_vel[1-i] == 0 ? min(free[i], abs(int_vel[i])) : 1;
+            pos[i] += s * step;
+            int_vel[i] -= s * step;
+            free[i] -= step;
+
+            // This could change how far we can move along the other axis.
+            free[1-i] = -1;
+        }
+    }
+
+    return blocked;
+}
@@ -18,6 +18,7 @@
 #include "gameutils/class_sequence.h"
 #include "gameutils/fps_counter.h"
 #include "gameutils/render.h"
+#include "gameutils/sprite_render.h"
 #include "gameutils/state.h"
 #include "graphics/complete.h"
 #include "input/complete.h"
@@ -47,3 +48,4 @@
 #include "utils/poly_storage.h"
 #include "utils/random.h"
 #include "utils/simple_iterator.h"
+#include "utils/thread_pool.h"
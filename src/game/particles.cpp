@@ -1,5 +1,74 @@
 #include "particles.h"
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+void ParticleController::Tick()
+{
+    std::size_t count = pos_x.size();
+    std::size_t i = 0;
+
+    // Integrate the motion, several particles at a time. The results are the same as in the scalar loop below.
+    #if defined(__AVX__)
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 vx = _mm256_add_ps(_mm256_load_ps(&vel_x[i]), _mm256_load_ps(&acc_x[i]));
+        __m256 vy = _mm256_add_ps(_mm256_load_ps(&vel_y[i]), _mm256_load_ps(&acc_y[i]));
+        __m256 factor = _mm256_sub_ps(_mm256_set1_ps(1), _mm256_load_ps(&drag[i]));
+        vx = _mm256_mul_ps(vx, factor);
+        vy = _mm256_mul_ps(vy, factor);
+        _mm256_store_ps(&vel_x[i], vx);
+        _mm256_store_ps(&vel_y[i], vy);
+        _mm256_store_ps(&pos_x[i], _mm256_add_ps(_mm256_load_ps(&pos_x[i]), vx));
+        _mm256_store_ps(&pos_y[i], _mm256_add_ps(_mm256_load_ps(&pos_y[i]), vy));
+    }
+    #endif
+    #if defined(__SSE2__) || defined(_M_X64)
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 vx = _mm_add_ps(_mm_load_ps(&vel_x[i]), _mm_load_ps(&acc_x[i]));
+        __m128 vy = _mm_add_ps(_mm_load_ps(&vel_y[i]), _mm_load_ps(&acc_y[i]));
+        __m128 factor = _mm_sub_ps(_mm_set1_ps(1), _mm_load_ps(&drag[i]));
+        vx = _mm_mul_ps(vx, factor);
+        vy = _mm_mul_ps(vy, factor);
+        _mm_store_ps(&vel_x[i], vx);
+        _mm_store_ps(&vel_y[i], vy);
+        _mm_store_ps(&pos_x[i], _mm_add_ps(_mm_load_ps(&pos_x[i]), vx));
+        _mm_store_ps(&pos_y[i], _mm_add_ps(_mm_load_ps(&pos_y[i]), vy));
+    }
+    #endif
+    for (; i < count; i++)
+    {
+        vel_x[i] = (vel_x[i] + acc_x[i]) * (1 - drag[i]);
+        vel_y[i] = (vel_y[i] + acc_y[i]) * (1 - drag[i]);
+        pos_x[i] += vel_x[i];
+        pos_y[i] += vel_y[i];
+    }
+
+    // The compiler vectorizes this one on its own.
+    for (std::size_t j = 0; j < count; j++)
+        time[j]++;
+
+    // Remove the dead particles, by moving the last ones in their place.
+    i = 0;
+    while (i < count)
+    {
+        if (time[i] < max_time[i])
+        {
+            i++;
+            continue;
+        }
+
+        count--;
+        ForEachArray([&](auto &array)
+        {
+            array[i] = array[count];
+            array.pop_back();
+        });
+    }
+}
+
 void ParticleController::Render(ivec2 camera_pos) const
 {
     static const Graphics::TextureAtlas::Region
@@ -9,24 +78,32 @@ void ParticleController::Render(ivec2 camera_pos) const
     constexpr int pixel_size = 8;
     constexpr int tex_frames = 5;
 
-    for (std::size_t i = list.size(); i-- > 0;)
+    // The particles use their own shader, so draw everything queued before them first.
+    r.Finish();
+
+    for (std::size_t i = Count(); i-- > 0;)
     {
-        const Particle &par = list[i];
+        fvec2 pos(pos_x[i], pos_y[i]);
+        float t = time[i] / float(max_time[i]);
 
-        bool has_custom_size = par.tex_index < 0;
-        float custom_size = !has_custom_size ? 0 : -par.tex_index * (1 - par.time / float(par.max_time));
+        bool has_custom_size = tex_index[i] < 0;
+        float custom_size = !has_custom_size ? 0 : -tex_index[i] * (1 - t);
 
-        if (((par.pos - camera_pos).abs() > screen_size/2 + (has_custom_size ? custom_size : pixel_size)/2).any())
+        if (((pos - camera_pos).abs() > screen_size/2 + (has_custom_size ? custom_size : pixel_size)/2).any())
             continue; // Not visible.
 
-        int frame = clamp(par.time * tex_frames / par.max_time, 0, tex_frames-1);
+        int frame = clamp(time[i] * tex_frames / max_time[i], 0, tex_frames-1);
+        Graphics::TextureAtlas::Region region = !has_custom_size ? tex.region(ivec2(frame, tex_index[i]) * pixel_size, ivec2(pixel_size)) : tex_custom_size;
 
-        auto quad = r.iquad(iround(par.pos) - camera_pos, !has_custom_size ? tex.region(ivec2(frame, par.tex_index) * pixel_size, ivec2(pixel_size)) : tex_custom_size)
-            .center()
-            .color(!par.end_color ? par.color : mix(par.time / float(par.max_time), par.color, *par.end_color))
-            .mix(0);
-
-        if (has_custom_size)
-            quad.scale(custom_size / tex_custom_size.size.x);
+        sprite_render.Add({
+            .pos = iround(pos) - camera_pos,
+            .size = !has_custom_size ? fvec2(region.size) : region.size * (custom_size / tex_custom_size.size.x),
+            .tex_pos = region.pos,
+            .tex_size = region.size,
+            .color = mix(t, color[i], end_color[i]),
+        });
     }
+
+    sprite_render.Finish();
+    r.BindShader();
 }
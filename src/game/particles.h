@@ -1,6 +1,16 @@
 #pragma once
 
 #include "main.h"
+#include "utils/alignment.h"
+
+// When over the particle budget, the particles with lower priorities are dropped first.
+enum class ParticlePriority
+{
+    low, // Map flames, menu effects.
+    medium, // Lamps, gate.
+    high, // Player.
+    _count,
+};
 
 struct Particle
 {
@@ -13,33 +23,113 @@ struct Particle
     int tex_index = 0; // If negative, treated as the custom size.
     fvec3 color;
     std::optional<fvec3> end_color;
+    ParticlePriority priority = ParticlePriority::low;
 };
 
 class ParticleController
 {
-    std::vector<Particle> list;
+    // Aligned to the widest SIMD register we might use.
+    template <typename T>
+    using AlignedVector = std::vector<T, Storage::AlignedAllocator<T, 32>>;
+
+    // The particles are stored as separate arrays, so `Tick()` can process them in bulk.
+    // The order of the particles is not preserved, the dead ones are replaced with the last ones.
+    AlignedVector<float> pos_x, pos_y, vel_x, vel_y, acc_x, acc_y, drag;
+    AlignedVector<int> time, max_time;
+    std::vector<int> tex_index; // If negative, treated as the custom size.
+    std::vector<fvec3> color, end_color; // If there's no end color, it's the same as `color`.
+
+    // Calls `func` for each of the arrays above.
+    template <typename F>
+    void ForEachArray(F &&func)
+    {
+        func(pos_x);
+        func(pos_y);
+        func(vel_x);
+        func(vel_y);
+        func(acc_x);
+        func(acc_y);
+        func(drag);
+        func(time);
+        func(max_time);
+        func(tex_index);
+        func(color);
+        func(end_color);
+    }
 
   public:
-    ParticleController() {}
+    static constexpr int num_priorities = int(ParticlePriority::_count);
 
-    void Tick()
+    struct Budget
     {
-        for (Particle &par : list)
-        {
-            par.time++;
-            par.vel += par.acc;
-            par.vel *= 1 - par.drag;
-            par.pos += par.vel;
-        }
+        std::size_t max_particles = 20000;
+        // New particles of each priority are dropped when the particle count reaches this fraction of `max_particles`.
+        // This leaves room for the higher priorities.
+        std::array<float, num_priorities> spawn_limit_fraction = {0.6f, 0.8f, 1};
+    };
+
+    struct Stats
+    {
+        // Per priority.
+        std::array<std::size_t, num_priorities> spawned{}, dropped{};
+    };
+
+  private:
+    Budget budget;
+    std::array<std::size_t, num_priorities> spawn_limit{}; // Computed from `budget`.
+    Stats stats;
+
+  public:
+    ParticleController() : ParticleController(Budget{}) {}
+    ParticleController(const Budget &budget)
+    {
+        SetBudget(budget);
+    }
 
-        std::erase_if(list, [](const Particle &par){return par.time >= par.max_time;});
+    [[nodiscard]] const Budget &GetBudget() const {return budget;}
+    void SetBudget(const Budget &new_budget)
+    {
+        budget = new_budget;
+        for (int i = 0; i < num_priorities; i++)
+            spawn_limit[i] = std::size_t(budget.max_particles * clamp(budget.spawn_limit_fraction[i]));
     }
 
+    // The counters accumulate until `ResetStats()`.
+    [[nodiscard]] const Stats &GetStats() const {return stats;}
+    void ResetStats() {stats = {};}
+
+    void Tick();
+
     void Render(ivec2 camera_pos) const;
 
+    [[nodiscard]] std::size_t Count() const
+    {
+        return pos_x.size();
+    }
+
+    // Drops the particle if over the budget for its priority.
     void Add(const Particle &par)
     {
-        list.push_back(par);
+        int priority = int(par.priority);
+        if (Count() >= spawn_limit[priority])
+        {
+            stats.dropped[priority]++;
+            return;
+        }
+        stats.spawned[priority]++;
+
+        pos_x.push_back(par.pos.x);
+        pos_y.push_back(par.pos.y);
+        vel_x.push_back(par.vel.x);
+        vel_y.push_back(par.vel.y);
+        acc_x.push_back(par.acc.x);
+        acc_y.push_back(par.acc.y);
+        drag.push_back(par.drag);
+        time.push_back(par.time);
+        max_time.push_back(par.max_time);
+        tex_index.push_back(par.tex_index);
+        color.push_back(par.color);
+        end_color.push_back(par.end_color.value_or(par.color));
     }
 
     void AddPlayerFlame(fvec2 pos, fvec2 vel)
@@ -51,6 +141,7 @@ class ParticleController
             end_color = fvec3(1, c + 0.5, 0),
             max_time = 20 <= irand <= 40,
             drag = 0.01,
+            priority = ParticlePriority::high,
         ));
     }
 
@@ -65,6 +156,7 @@ class ParticleController
             time = max_time / 2,
             max_time = max_time,
             drag = 0.01,
+            priority = ParticlePriority::high,
         ));
     }
 
@@ -78,6 +170,7 @@ class ParticleController
             end_color = b ? fvec3() : fvec3(1, c + 0.5, 0),
             max_time = 40 <= irand <= 60,
             drag = 0.01,
+            priority = ParticlePriority::high,
         ));
     }
 
@@ -116,6 +209,7 @@ class ParticleController
             end_color = fvec3(c * 0.5, 0.5 + c * 0.5, 1),
             max_time = 60 <= irand <= 90,
             drag = 0.01,
+            priority = ParticlePriority::medium,
         ));
     }
 
@@ -130,6 +224,7 @@ class ParticleController
             time = max_time / 2,
             max_time = max_time,
             drag = 0.005,
+            priority = ParticlePriority::medium,
         ));
     }
 
@@ -142,6 +237,7 @@ class ParticleController
             end_color = fvec3(c * 0.5, 0.5 + c * 0.5, 1),
             max_time = 90 <= irand <= 180,
             drag = 0.01,
+            priority = ParticlePriority::medium,
         ));
     }
 
@@ -11,12 +11,12 @@ namespace States
         struct Label
         {
             ivec2 pos{};
-            Graphics::Text text;
+            Render::PreparedText text;
             ivec2 size{};
 
-            Label(ivec2 new_pos, Graphics::Text new_text) : pos(new_pos), text(std::move(new_text))
+            Label(ivec2 new_pos, const Graphics::Text &new_text) : pos(new_pos), text(new_text)
             {
-                size = text.ComputeStats().size;
+                size = text.Size();
             }
         };
 
@@ -109,14 +109,50 @@ struct SpikeBlock
         return (pixel_pos >= pos with(y -= (height-1) * tile_size) - tile_size/2).all() && (pixel_pos < pos + tile_size/2).all();
     }
 
+    // Only the first point is used for spike-spike collisions.
+    [[nodiscard]] std::array<ivec2, 2> HitboxPoints() const
+    {
+        return {ivec2(0,5), ivec2(0,-8 - (height - 1) * tile_size)}; // Note `-8`, this lets spikes stick to the ceiling.
+    }
+
     [[nodiscard]] bool SolidAtOffset(const Map &map, ivec2 offset) const
     {
-        // Only the first point is used for spike-spike collisions.
-        const std::array<ivec2, 2> hitbox_points = {ivec2(0,5), ivec2(0,-8 - (height - 1) * tile_size)}; // Note `-8`, this lets spikes stick to the ceiling.
+        const std::array<ivec2, 2> hitbox_points = HitboxPoints();
 
         return std::any_of(hitbox_points.begin(), hitbox_points.end(), [&](ivec2 point){return map.PixelIsSolid(pos + point + offset);})
             || std::any_of(same_x_spikes->begin(), same_x_spikes->end(), [&](const SpikeBlock *other){return other != this && other->PixelTouches(pos + hitbox_points.front() + offset);});
     }
+
+    // How far the block can move vertically in direction `dir`, at most `max_dist`. Consistent with `SolidAtOffset()`.
+    [[nodiscard]] int FreeDistanceY(const Map &map, int dir, int max_dist) const
+    {
+        const std::array<ivec2, 2> hitbox_points = HitboxPoints();
+
+        int ret = max_dist;
+        for (ivec2 point : hitbox_points)
+            ret = map.RectFreeDistance(pos + point, pos + point, 1, dir, ret);
+
+        ivec2 point = pos + hitbox_points.front();
+        for (const SpikeBlock *other : *same_x_spikes)
+        {
+            if (other == this)
+                continue;
+
+            // Same as in `PixelTouches()`.
+            ivec2 a = other->pos with(y -= (other->height-1) * tile_size) - tile_size/2;
+            ivec2 b = other->pos + tile_size/2;
+            if (point.x < a.x || point.x >= b.x)
+                continue;
+
+            // The first step at which the point would touch the other block.
+            int step = dir > 0 ? a.y - point.y : point.y - (b.y - 1);
+            clamp_var_min(step, 1);
+            if (point.y + step * dir >= a.y && point.y + step * dir < b.y)
+                clamp_var_max(ret, step - 1);
+        }
+
+        return ret;
+    }
 };
 
 struct Player
@@ -143,18 +179,11 @@ struct Player
 
     static constexpr ivec2 hitbox_a = ivec2(-4, -5), hitbox_b = ivec2(3, 4);
 
-    [[nodiscard]] bool SolidAtOffset(Map &map, ivec2 offset)
+    [[nodiscard]] bool SolidAtOffset(const Map &map, ivec2 offset) const
     {
-        for (int point_y : {hitbox_a.y, hitbox_b.y})
-        for (int point_x : {hitbox_a.x, hitbox_b.x})
-        {
-            ivec2 point = pos + offset + ivec2(point_x, point_y);
-
-            if (map.PixelIsSolid(point))
-                return true;
-        }
-
-        return false;
+        // Since the hitbox is smaller than a tile, testing the whole rectangle is equivalent to testing its corners.
+        static_assert((hitbox_b - hitbox_a < tile_size).all());
+        return map.AnyPixelSolidInRect(pos + offset + hitbox_a, pos + offset + hitbox_b);
     }
 };
 
@@ -198,11 +227,20 @@ namespace States
 
         struct TutMessage
         {
-            std::string a, b;
+            Render::PreparedText a, b;
             std::function<bool()> should_hide;
             int hide_timer = 0;
+
+            TutMessage(std::string_view new_a, std::string_view new_b, std::function<bool()> new_should_hide)
+                : a(Graphics::Text(Fonts::main, new_a), ivec2(1, -1)), b(Graphics::Text(Fonts::main, new_b), ivec2(-1, -1)), should_hide(std::move(new_should_hide))
+            {}
         };
         std::vector<TutMessage> tut_messages;
+        Render::PreparedText tut_dash_text;
+
+        Render::PreparedText level_index_text;
+
+        mutable Render::CommandList render_commands; // Only used during `Render()`. It's a member only to reuse the memory.
 
         [[nodiscard]] static std::string GetLevelFileName(int index)
         {
@@ -220,7 +258,7 @@ namespace States
 
             texture_atlas.InitRegions(atlas, ".png");
             map = Map(GetLevelFileName(level_index));
-            camera_pos = camera_target_pos = map.cells.size() * tile_size / 2;
+            camera_pos = camera_target_pos = map.Size() * tile_size / 2;
 
             // Player.
             p.pos = ivec2(map.points.GetSinglePoint("player"));
@@ -263,11 +301,24 @@ namespace States
             { // Tutorial.
                 if (map.points.GetSinglePointOpt("want_tutorial"))
                 {
-                    tut_messages.push_back({.a = "Arrows/WASD", .b = "move",                      .should_hide = [&]{return con.LeftDown() || con.RightDown();}});
-                    tut_messages.push_back({.a = "Z/Space/Up", .b = "jump (hold to jump higher)", .should_hide = [&]{return con.JumpDown() && p.vel.y > 0;}});
-                    tut_messages.push_back({.a = "R", .b = "restart level",                       .should_hide = [&]{return con.RestartPressed();}});
-                    tut_messages.push_back({.a = "M", .b = "mute music",                          .should_hide = [&]{return con.MutePressed();}});
+                    tut_messages.emplace_back("Arrows/WASD", "move",                      [&]{return con.LeftDown() || con.RightDown();});
+                    tut_messages.emplace_back("Z/Space/Up", "jump (hold to jump higher)", [&]{return con.JumpDown() && p.vel.y > 0;});
+                    tut_messages.emplace_back("R", "restart level",                       [&]{return con.RestartPressed();});
+                    tut_messages.emplace_back("M", "mute music",                          [&]{return con.MutePressed();});
                 }
+
+                tut_dash_text = Render::PreparedText(Graphics::Text(Fonts::main, "-"), ivec2(0, -1));
+            }
+
+            { // Level index.
+                static const std::vector<std::string_view> roman_numbers = {"I","II","III","IV","V","VI","VII","VIII","IX","X","XI","XII","XIII","XIV","XV"};
+                std::string text;
+                if (level_index-1 < int(roman_numbers.size()))
+                    text = roman_numbers[level_index-1];
+                else
+                    text = FMT("{}", level_index);
+
+                level_index_text = Render::PreparedText(Graphics::Text(Fonts::main, text));
             }
 
             { // Parameters.
@@ -411,7 +462,7 @@ namespace States
                     if (p.death_timer == 0)
                     {
                         for (ivec2 point : {ivec2(p.hitbox_b.x+1, 0), ivec2(p.hitbox_a.x-1, 0), ivec2(0, p.hitbox_b.y+1), ivec2(0, p.hitbox_a.y-1)})
-                            map.CorrputTile(div_ex(p.pos + point, tile_size), Cell::num_corruption_stages);
+                            map.CorrputTile(div_ex(p.pos + point, tile_size), Map::num_corruption_stages);
                     }
                 }
 
@@ -437,32 +488,13 @@ namespace States
                                 p.vel_lag[i] = 0;
                         }
 
-                        while (int_vel)
+                        ivec2 blocked = map.MoveRect(p.pos, int_vel, p.hitbox_a, p.hitbox_b);
+                        for (int i : {0, 1})
                         {
-                            for (int i : {0, 1})
-                            {
-                                if (int_vel[i] == 0)
-                                    continue;
-
-                                int s = sign(int_vel[i]);
-
-                                ivec2 offset{};
-                                offset[i] = s;
-
-                                if (!p.SolidAtOffset(map, offset))
-                                {
-                                    p.pos[i] += s;
-                                    int_vel[i] -= s;
-                                }
-                                else
-                                {
-                                    int_vel[i] = 0;
-                                    if (p.vel[i] * s > 0)
-                                        p.vel[i] = 0;
-                                    if (p.vel_lag[i] * s > 0)
-                                        p.vel_lag[i] = 0;
-                                }
-                            }
+                            if (p.vel[i] * blocked[i] > 0)
+                                p.vel[i] = 0;
+                            if (p.vel_lag[i] * blocked[i] > 0)
+                                p.vel_lag[i] = 0;
                         }
                     }
                 }
@@ -479,7 +511,7 @@ namespace States
                             constexpr int margin = tile_size / 2;
 
                             // Check all borders except the top one.
-                            if ((p.pos >= map.cells.size() * tile_size + margin).any() || p.pos.x < -margin)
+                            if ((p.pos >= map.Size() * tile_size + margin).any() || p.pos.x < -margin)
                                 p.Kill();
                         }
 
@@ -488,7 +520,7 @@ namespace States
                             for (int point_x : {p.hitbox_a.x, p.hitbox_b.x})
                             {
                                 ivec2 tile_pos = div_ex(p.pos + ivec2(point_x, point_y), tile_size);
-                                if (map.cells.pos_in_range(tile_pos) && GetTileInfo(map.cells.unsafe_at(tile_pos).tile).kills)
+                                if (map.PosInRange(tile_pos) && GetTileInfo(map.GetTile(tile_pos)).kills)
                                     p.Kill();
                             }
                         }
@@ -551,27 +583,11 @@ namespace States
                         else
                             spike.vel_lag = 0;
 
-                        while (int_vel)
-                        {
-                            int s = sign(int_vel);
-
-                            ivec2 offset{};
-                            offset.y = s;
-
-                            if (!spike.SolidAtOffset(map, offset))
-                            {
-                                spike.pos.y += s;
-                                int_vel -= s;
-                            }
-                            else
-                            {
-                                int_vel = 0;
-                                if (spike.vel * s > 0)
-                                    spike.vel = 0;
-                                if (spike.vel_lag * s > 0)
-                                    spike.vel_lag = 0;
-                            }
-                        }
+                        ivec2 blocked = SweepMove(spike.pos, ivec2(0, int_vel), [&](ivec2, int, int dir, int max_dist){return spike.FreeDistanceY(map, dir, max_dist);});
+                        if (spike.vel * blocked.y > 0)
+                            spike.vel = 0;
+                        if (spike.vel_lag * blocked.y > 0)
+                            spike.vel_lag = 0;
                     }
                 }
             }
@@ -637,32 +653,13 @@ namespace States
                                 lamp.vel_lag[i] = 0;
                         }
 
-                        while (int_vel)
+                        ivec2 blocked = map.MoveRect(lamp.pos, int_vel, hitpoint_offset, hitpoint_offset);
+                        for (int i : {0, 1})
                         {
-                            for (int i : {0, 1})
-                            {
-                                if (int_vel[i] == 0)
-                                    continue;
-
-                                int s = sign(int_vel[i]);
-
-                                ivec2 offset{};
-                                offset[i] = s;
-
-                                if (!map.PixelIsSolid(lamp.pos + hitpoint_offset + offset))
-                                {
-                                    lamp.pos[i] += s;
-                                    int_vel[i] -= s;
-                                }
-                                else
-                                {
-                                    int_vel[i] = 0;
-                                    if (lamp.vel[i] * s > 0)
-                                        lamp.vel[i] = 0;
-                                    if (lamp.vel_lag[i] * s > 0)
-                                        lamp.vel_lag[i] = 0;
-                                }
-                            }
+                            if (lamp.vel[i] * blocked[i] > 0)
+                                lamp.vel[i] = 0;
+                            if (lamp.vel_lag[i] * blocked[i] > 0)
+                                lamp.vel_lag[i] = 0;
                         }
                     }
 
@@ -733,32 +730,13 @@ namespace States
                             gate.vel_lag[i] = 0;
                     }
 
-                    while (int_vel)
+                    ivec2 blocked = SweepMove(gate.pos, int_vel, [&](ivec2 pos, int axis, int dir, int max_dist){return map.RectFreeDistance(pos + hitpoint_offset, pos + hitpoint_offset, axis, dir, max_dist);});
+                    for (int i : {0, 1})
                     {
-                        for (int i : {0, 1})
-                        {
-                            if (int_vel[i] == 0)
-                                continue;
-
-                            int s = sign(int_vel[i]);
-
-                            ivec2 offset{};
-                            offset[i] = s;
-
-                            if (!map.PixelIsSolid(gate.pos + hitpoint_offset + offset))
-                            {
-                                gate.pos[i] += s;
-                                int_vel[i] -= s;
-                            }
-                            else
-                            {
-                                int_vel[i] = 0;
-                                if (gate.vel[i] * s > 0)
-                                    gate.vel[i] = 0;
-                                if (gate.vel_lag[i] * s > 0)
-                                    gate.vel_lag[i] = 0;
-                            }
-                        }
+                        if (gate.vel[i] * blocked[i] > 0)
+                            gate.vel[i] = 0;
+                        if (gate.vel_lag[i] * blocked[i] > 0)
+                            gate.vel_lag[i] = 0;
                     }
                 }
             }
@@ -814,21 +792,23 @@ namespace States
             Graphics::Clear();
             r.BindShader();
 
+            // The frame is recorded first and then submitted at once. The state changes `Render` doesn't know about are recorded as callbacks.
+            render_commands.Clear();
+            r.BeginRecording(render_commands);
+
             sky.Render();
 
             { // Map.
-                r.Finish();
-
                 // Render the map itself to a separate texture.
-                framebuffer_map.Bind();
-                Graphics::SetClearColor(fvec4(0));
-                Graphics::Clear();
+                r.Callback([]{
+                    framebuffer_map.Bind();
+                    Graphics::SetClearColor(fvec4(0));
+                    Graphics::Clear();
+                });
                 map.Render(camera_pos);
-                r.Finish();
-                Graphics::Blending::Func(Graphics::Blending::one, Graphics::Blending::one_minus_src_a, Graphics::Blending::zero, Graphics::Blending::one);
+                r.Callback([]{Graphics::Blending::Func(Graphics::Blending::one, Graphics::Blending::one_minus_src_a, Graphics::Blending::zero, Graphics::Blending::one);});
                 map.RenderCorruption(camera_pos);
-                r.Finish();
-                Graphics::Blending::FuncNormalPre();
+                r.Callback([]{Graphics::Blending::FuncNormalPre();});
 
                 { // Objects that should have outline.
                     { // Lamps.
@@ -842,15 +822,13 @@ namespace States
                         r.iquad(gate.pos with(y -= 6) - camera_pos, atlas.gate).center();
                     }
                 }
-                r.Finish();
 
                 // Render that texture to the main framebuffer, with outline.
-                adaptive_viewport.GetFrameBuffer().Bind();
+                r.Callback([]{adaptive_viewport.GetFrameBuffer().Bind();});
                 r.SetTexture(framebuffer_texture_map);
                 for (int i = 0; i < 4; i++)
                     r.iquad(ivec2::dir4(i), screen_size).tex(ivec2(0)).color(fvec3(0)).mix(0).center().flip_y().alpha(outline_alpha);
                 r.iquad(ivec2(0), screen_size).tex(ivec2(0)).center().flip_y();
-                r.Finish();
 
                 r.SetTexture(texture_main);
             }
@@ -862,7 +840,8 @@ namespace States
                 r.iquad(p.pos - camera_pos, atlas.player.region(ivec2(0, player_tex_size * frame), ivec2(player_tex_size))).center().flip_x(p.left).color(fvec3(1, frand <= 1, 0)).mix(0).alpha(p_alpha);
             }
 
-            par.Render(camera_pos);
+            // The particles use their own renderer.
+            r.Callback([this]{par.Render(camera_pos);});
 
             { // Player (after particles).
                 r.iquad(p.pos - camera_pos + ivec2(p.left ? -1 : 0, 0), atlas.player.region(ivec2(player_tex_size, 0), ivec2(player_tex_size))).center().alpha(p_alpha);
@@ -886,16 +865,8 @@ namespace States
                     ivec2 offset = i < 0 ? ivec2(0) : ivec2::dir4(i);
                     fvec3 color = i < 0 ? fvec3(1) : fvec3(0);
 
-                    { // Level index.
-                        static const std::vector<std::string_view> roman_numbers = {"I","II","III","IV","V","VI","VII","VIII","IX","X","XI","XII","XIII","XIV","XV"};
-                        std::string text;
-                        if (level_index-1 < int(roman_numbers.size()))
-                            text = roman_numbers[level_index-1];
-                        else
-                            text = FMT("{}", level_index);
-
-                        r.itext(ivec2(0,-screen_size.y/2 + 10) + (camera_target_pos - camera_pos) * -1 + offset, Graphics::Text(Fonts::main, text)).color(color);
-                    }
+                    // Level index.
+                    r.itext(ivec2(0,-screen_size.y/2 + 10) + (camera_target_pos - camera_pos) * -1 + offset, level_index_text).color(color);
 
                     // Tutorial.
                     int message_y = tut_messages.size();
@@ -903,9 +874,9 @@ namespace States
                     {
                         float alpha = smoothstep(clamp_min(1 - msg.hide_timer/60. * (i < 0 ? 1 : 4)));
                         ivec2 pos = ivec2(0, screen_size.y/2 - message_y * 16) + (camera_target_pos - camera_pos) * 2;
-                        r.itext(pos with(x -= 10) + offset, Graphics::Text(Fonts::main, msg.a)).color(color).alpha(alpha).align(ivec2( 1, -1));
-                        r.itext(pos               + offset, Graphics::Text(Fonts::main, "-")).color(color).alpha(alpha).align(ivec2(0, -1));
-                        r.itext(pos with(x += 10) + offset, Graphics::Text(Fonts::main, msg.b)).color(color).alpha(alpha).align(ivec2(-1, -1));
+                        r.itext(pos with(x -= 10) + offset, msg.a        ).color(color).alpha(alpha);
+                        r.itext(pos               + offset, tut_dash_text).color(color).alpha(alpha);
+                        r.itext(pos with(x += 10) + offset, msg.b        ).color(color).alpha(alpha);
                         message_y--;
                     }
                 }
@@ -914,6 +885,8 @@ namespace States
             // Scene transition.
             scene_switch.Render();
 
+            r.EndRecording();
+            r.Submit(render_commands);
             r.Finish();
         }
     };
@@ -33,14 +33,14 @@ namespace States
         struct Entry
         {
             ivec2 pos{};
-            Graphics::Text text;
+            Render::PreparedText text;
             ivec2 size{};
             std::function<void(std::string &)> func;
 
-            Entry(ivec2 new_pos, Graphics::Text new_text, std::function<void(std::string &)> new_func)
-                : pos(new_pos), text(std::move(new_text)), func(std::move(new_func))
+            Entry(ivec2 new_pos, const Graphics::Text &new_text, std::function<void(std::string &)> new_func)
+                : pos(new_pos), text(new_text), func(std::move(new_func))
             {
-                size = text.ComputeStats().size;
+                size = text.Size();
             }
         };
 
@@ -60,8 +60,9 @@ namespace States
 
         SavedProgress saved_progress;
 
-        Graphics::Text title_text;
+        Render::PreparedText title_text;
         ivec2 title_size{};
+        Render::PreparedText author_text;
         ivec2 title_pos = ivec2(0,-4);
 
         void Init() override
@@ -75,8 +76,12 @@ namespace States
             }
 
             { // Title.
-                title_text = Graphics::Text(Fonts::main, "BRIMSTONE");
-                title_size = title_text.ComputeStats().size;
+                title_text = Render::PreparedText(Graphics::Text(Fonts::main, "BRIMSTONE"));
+                title_size = title_text.Size();
+            }
+
+            { // Author info.
+                author_text = Render::PreparedText(Graphics::Text(Fonts::main, "v" + version + ", Oct 2021, by HolyBlackCat for LD49"), ivec2(0,1));
             }
 
             { // Menu entries.
@@ -177,10 +182,10 @@ namespace States
                 r.itext(e.pos, e.text).color(fvec3(1)).alpha(text_alpha);
 
             // Author info.
-            r.itext(ivec2(0, screen_size.y/2), Graphics::Text(Fonts::main, "v" + version + ", Oct 2021, by HolyBlackCat for LD49")).color(fvec3(46,45,108)/255).alpha(text_alpha).align(ivec2(0,1));
+            r.itext(ivec2(0, screen_size.y/2), author_text).color(fvec3(46,45,108)/255).alpha(text_alpha);
 
             { // Vignette.
-                static const Graphics::TextureAtlas::Region vignette = texture_atlas.Get("vignette.png");
+                const Graphics::TextureAtlas::Region vignette = texture_atlas.Get<"vignette.png">();
                 r.iquad(ivec2(0), vignette).center().alpha(0.5);
             }
 
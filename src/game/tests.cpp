@@ -0,0 +1,621 @@
+#include "tests.h"
+
+#include <filesystem>
+#include <random>
+
+#include "game/main.h"
+#include "game/map.h"
+#include "game/particles.h"
+#include "stream/save_to_file.h"
+#include "utils/packing.h"
+
+namespace Tests
+{
+    // Repeats a real level to the specified size, and corrupts 8x8 areas on a 32-tile grid.
+    [[nodiscard]] static Map CorruptedMap(ivec2 size)
+    {
+        Map ret = Map("assets/maps/1.json").Repeated(size);
+        ret.play_sounds = false;
+        for (int y = 0; y < ret.Size().y; y += 32)
+        for (int x = 0; x < ret.Size().x; x += 32)
+        for (auto pos : vector_range(ivec2(8)))
+            ret.CorrputTile(ivec2(x, y) + pos, Map::num_corruption_stages);
+        return ret;
+    }
+
+    // Makes a map that is mostly corruptable, with some walls and air, and corrupts a cell in the middle of each 32x32 area.
+    // The levels have few corruptable tiles, so this gives longer chain reactions.
+    [[nodiscard]] static Map RandomCorruptedMap(ivec2 size)
+    {
+        std::minstd_rand generator(42);
+        Random::Scalar<int, std::minstd_rand> rand(generator);
+
+        Map ret(size);
+        ret.play_sounds = false;
+        for (auto pos : vector_range(size))
+        {
+            int value = 0 <= rand < 20;
+            ret.SetTile(pos, value < 2 ? Tile::air : value < 4 ? Tile::wall : value < 6 ? Tile::grass : Tile::dirt);
+        }
+        for (int y = 16; y < size.y; y += 32)
+        for (int x = 16; x < size.x; x += 32)
+        {
+            ret.SetTile(ivec2(x, y), Tile::dirt);
+            ret.CorrputTile(ivec2(x, y), Map::num_corruption_stages);
+        }
+        return ret;
+    }
+
+    [[nodiscard]] static bool CorruptionBurnedOut(const Map &map)
+    {
+        for (auto chunk_pos : vector_range(map.ChunkGridSize()))
+        {
+            if (map.GetChunk(chunk_pos).num_corrupted > 0)
+                return false;
+        }
+        return true;
+    }
+
+    static void CorruptionDeterminism()
+    {
+        constexpr int num_ticks = 200;
+
+        Map base = CorruptedMap(ivec2(512));
+        base.two_phase_tick = true;
+
+        struct Snapshot
+        {
+            std::vector<Tile> tiles;
+            std::vector<Map::CellCorruption> corruption;
+            std::size_t particles = 0;
+
+            [[nodiscard]] bool operator==(const Snapshot &other) const
+            {
+                return tiles == other.tiles && particles == other.particles && std::equal(corruption.begin(), corruption.end(), other.corruption.begin(), other.corruption.end(), [](const Map::CellCorruption &a, const Map::CellCorruption &b)
+                {
+                    return a.start_time == b.start_time && a.stage == b.stage && a.damage == b.damage && a.visual_damage == b.visual_damage;
+                });
+            }
+        };
+
+        auto Simulate = [&](int num_threads)
+        {
+            ThreadPool pool(num_threads);
+            Map map = base;
+            ParticleController par;
+
+            for (int i = 0; i < num_ticks; i++)
+                map.Tick(par, pool);
+
+            Snapshot ret;
+            for (auto pos : vector_range(map.Size()))
+            {
+                ret.tiles.push_back(map.GetTile(pos));
+                ret.corruption.push_back(map.GetCorruption(pos));
+            }
+            ret.particles = par.Count();
+            return ret;
+        };
+
+        // The same thread count twice, then different ones.
+        Snapshot expected = Simulate(1);
+        for (int num_threads : {1, 2, 8})
+        {
+            if (Simulate(num_threads) != expected)
+                Program::Error(FMT("The two-phase corruption tick gave different results with {} threads.", num_threads));
+        }
+    }
+
+    static void TwoPhaseCorruptionDifference()
+    {
+        constexpr int max_ticks = 50000;
+        // How much earlier or later the individual cells can explode with the two-phase tick.
+        constexpr int max_explosion_time_difference = 64;
+
+        const Map base = RandomCorruptedMap(ivec2(128));
+
+        // Runs the corruption until it burns out. Returns the tiles, and the time when each cell exploded (or 0 if it didn't).
+        auto Simulate = [&](bool two_phase)
+        {
+            ThreadPool pool(2);
+            Map map = base;
+            map.two_phase_tick = two_phase;
+            ParticleController par;
+
+            std::vector<int> explosion_times(map.Size().prod());
+            while (!CorruptionBurnedOut(map))
+            {
+                if (map.Time() > max_ticks)
+                    Program::Error(FMT("The corruption didn't burn out in {} ticks.", max_ticks));
+
+                map.Tick(par, pool);
+                par.Tick();
+
+                for (auto pos : vector_range(map.Size()))
+                {
+                    int &time = explosion_times[pos.x + pos.y * map.Size().x];
+                    if (time == 0 && map.GetTile(pos) == Tile::air && base.GetTile(pos) != Tile::air)
+                        time = map.Time();
+                }
+            }
+
+            std::vector<Tile> tiles;
+            for (auto pos : vector_range(map.Size()))
+                tiles.push_back(map.GetTile(pos));
+            return std::pair(tiles, explosion_times);
+        };
+
+        auto [sequential_tiles, sequential_times] = Simulate(false);
+        auto [two_phase_tiles, two_phase_times] = Simulate(true);
+
+        if (sequential_tiles != two_phase_tiles)
+            Program::Error("The two-phase corruption tick destroyed different tiles.");
+
+        int max_difference = 0;
+        for (std::size_t i = 0; i < sequential_times.size(); i++)
+            clamp_var_min(max_difference, abs(sequential_times[i] - two_phase_times[i]));
+        if (max_difference > max_explosion_time_difference)
+            Program::Error(FMT("With the two-phase corruption tick, some cells exploded {} ticks earlier or later, at most {} is allowed.", max_difference, max_explosion_time_difference));
+    }
+
+    static void CorruptionWorklist()
+    {
+        constexpr int max_ticks = 50000;
+
+        Map worklist = RandomCorruptedMap(ivec2(128));
+        Map full_sweep = worklist;
+        ParticleController par;
+
+        auto SameCells = [&]
+        {
+            for (auto pos : vector_range(worklist.Size()))
+            {
+                const Map::CellCorruption &a = worklist.GetCorruption(pos), &b = full_sweep.GetCorruption(pos);
+                if (worklist.GetTile(pos) != full_sweep.GetTile(pos) || a.stage != b.stage || (a.stage != 0 && (a.start_time != b.start_time || a.damage != b.damage || a.visual_damage != b.visual_damage)))
+                    return false;
+            }
+            return true;
+        };
+
+        while (!CorruptionBurnedOut(worklist))
+        {
+            if (worklist.Time() > max_ticks)
+                Program::Error(FMT("The corruption didn't burn out in {} ticks.", max_ticks));
+
+            worklist.Tick(par);
+            full_sweep.TickFullSweep(par);
+
+            if (!SameCells())
+                Program::Error(FMT("The corruption worklist diverged from the full sweep at tick {}.", worklist.Time()));
+        }
+
+        if (!CorruptionBurnedOut(full_sweep))
+            Program::Error("The corruption burned out with the worklist, but not with the full sweep.");
+    }
+
+    static void CommandListSorting()
+    {
+        // Without a GL context there are no textures, so the two textures are told apart by their sizes.
+        constexpr ivec2 texture_a = ivec2(64), texture_b = ivec2(128);
+
+        Render render = Render::Headless();
+        Render::CommandList list;
+        int blend_changes = 0;
+
+        // Quad `i` is drawn at `x == i`.
+        auto DrawQuad = [&](ivec2 texture_size, int i)
+        {
+            render.SetTextureSize(texture_size);
+            render.fquad(fvec2(i, 0), fvec2(1)).tex(fvec2(i * 10, 0));
+        };
+
+        render.BeginRecording(list);
+        DrawQuad(texture_a, 0);
+        DrawQuad(texture_b, 1);
+        DrawQuad(texture_a, 2);
+        render.Callback([&]{blend_changes++;});
+        DrawQuad(texture_b, 3);
+        DrawQuad(texture_a, 4);
+        render.EndRecording();
+
+        if (blend_changes != 0)
+            Program::Error("The callback was called during the recording.");
+        if (list.commands.size() != 6 || list.DrawCommandCount() != 5)
+            Program::Error(FMT("Expected 6 commands before sorting, got {}.", list.commands.size()));
+
+        list.SortByState();
+
+        // The quads are grouped by texture, but not across the blend change.
+        struct ExpectedCommand
+        {
+            bool callback = false;
+            ivec2 texture_size;
+            std::vector<int> quads;
+        };
+        const ExpectedCommand expected[] = {
+            {false, texture_a, {0, 2}},
+            {false, texture_b, {1}},
+            {true, {}, {}},
+            {false, texture_b, {3}},
+            {false, texture_a, {4}},
+        };
+
+        if (list.commands.size() != std::size(expected))
+            Program::Error(FMT("Expected {} commands after sorting, got {}.", std::size(expected), list.commands.size()));
+        if (list.vertices.size() != 5 * 4)
+            Program::Error(FMT("Expected 20 vertices after sorting, got {}.", list.vertices.size()));
+
+        for (std::size_t i = 0; i < std::size(expected); i++)
+        {
+            const Render::CommandList::Command &command = list.commands[i];
+            if (bool(command.callback) != expected[i].callback)
+                Program::Error(FMT("Command {} has the wrong type.", i));
+
+            if (command.callback)
+            {
+                command.callback();
+                continue;
+            }
+
+            if (command.state.texture_size != expected[i].texture_size || command.quad_count != expected[i].quads.size())
+                Program::Error(FMT("Command {} has the wrong state or quad count.", i));
+
+            for (std::size_t j = 0; j < command.quad_count; j++)
+            {
+                int quad = expected[i].quads[j];
+                const Render::CommandList::Vertex *v = &list.vertices[(command.first_quad + j) * 4];
+                const fvec2 corners[4] = {fvec2(0, 0), fvec2(1, 0), fvec2(1, 1), fvec2(0, 1)};
+                for (int k = 0; k < 4; k++)
+                {
+                    if (v[k].pos != fvec2(quad, 0) + corners[k] || v[k].texcoord != fvec2(quad * 10, 0) + corners[k])
+                        Program::Error(FMT("Quad {} of command {} has wrong vertices.", j, i));
+                }
+            }
+        }
+
+        if (blend_changes != 1)
+            Program::Error("The recorded callback didn't work.");
+    }
+
+    static void GlyphCacheEviction()
+    {
+        Graphics::FontFile file("assets/CatIV15.ttf", 15);
+        Graphics::Font font;
+
+        // Room for three pages. The first one is never evicted, so it's filled before the tested text is requested.
+        int page_height = file.Height() + 2;
+        Graphics::Image image(ivec2(64, page_height * 3 + 2));
+        Graphics::GlyphCache cache(font, file, image, ivec2(0), image.Size(), page_height);
+
+        constexpr std::string_view str = "AV";
+        auto IsCached = [&](uint32_t ch) {return &font.Get(ch) != &font.DefaultGlyph();};
+
+        // Compares the layout against a fresh one.
+        auto CheckLayout = [&](const Render::PreparedText &text, std::string_view context)
+        {
+            Render::PreparedText fresh(font, str);
+            if (text.Size() != fresh.Size() || !std::equal(text.Vertices().begin(), text.Vertices().end(), fresh.Vertices().begin(), fresh.Vertices().end(), [](const Render::PreparedText::Vertex &a, const Render::PreparedText::Vertex &b)
+            {
+                return a.pos == b.pos && a.texcoord == b.texcoord;
+            }))
+            {
+                Program::Error(FMT("The prepared text wasn't updated {}.", context));
+            }
+        };
+
+        cache.Request("0123456789");
+        cache.NextFrame();
+        cache.Request(str);
+        if (!IsCached('A') || !IsCached('V'))
+            Program::Error("The requested glyphs weren't added to the font.");
+
+        Render::PreparedText text(font, str);
+        std::uint64_t generation = font.Generation();
+
+        // Request other glyphs, one per frame, until the page with the text is evicted.
+        for (int i = 0; IsCached('A') && IsCached('V'); i++)
+        {
+            if (i > 1000)
+                Program::Error("The glyph cache never evicted the page.");
+            cache.NextFrame();
+            cache.Request('a' + i % 26);
+        }
+        if (cache.GetStats().evicted_pages == 0 || font.Generation() == generation)
+            Program::Error("The font generation didn't change after the eviction.");
+        CheckLayout(text, "after the eviction");
+
+        cache.NextFrame();
+        cache.Request(str);
+        if (!IsCached('A') || !IsCached('V'))
+            Program::Error("The evicted glyphs weren't added back.");
+        CheckLayout(text, "after requesting the glyphs again");
+
+        // The kerning matches the file, including the pairs with the glyphs that are no longer cached.
+        for (uint32_t a : {'A', 'V', '0', 'a'})
+        for (uint32_t b : {'A', 'V', '0', 'a'})
+        {
+            if (font.Kerning(a, b) != file.Kerning(a, b))
+                Program::Error(FMT("Wrong kerning for `{}{}`.", char(a), char(b)));
+        }
+    }
+
+    static void KerningTableFallback()
+    {
+        Graphics::Font font;
+        font.SetKerningFunc([](uint32_t a, uint32_t b){return a == 'A' && b == 0x416 ? -3 : 0;});
+        font.ResetKerningTable();
+        font.SetKerningPair('A', 'V', -2);
+
+        // Without a limit, the table covers all pairs.
+        if (font.Kerning('A', 'V') != -2 || font.Kerning('A', 0x416) != 0)
+            Program::Error("Wrong kerning from a complete kerning table.");
+
+        // With a limit, the pairs outside of it use the kerning function.
+        font.SetKerningTableCharLimit(Graphics::Font::flat_glyph_count);
+        if (font.Kerning('A', 'V') != -2 || font.Kerning('V', 'A') != 0 || font.Kerning('A', 0x416) != -3 || font.Kerning(0x416, 'A') != 0)
+            Program::Error("Wrong kerning from a partial kerning table.");
+        if (!font.HasKerning())
+            Program::Error("A font with a partial kerning table should have kerning.");
+    }
+
+    static void SpriteRenderMatchesRender()
+    {
+        InitWindow(true);
+
+        const ivec2 target_size = ivec2(64);
+        constexpr int sprite_count = 30000; // More than fits into one batch.
+
+        // The alpha varies across the texture, to check the texture coordinates.
+        Graphics::Image image(ivec2(8));
+        for (auto pos : vector_range(image.Size()))
+            image.UnsafeAt(pos) = u8vec4(255, 255, 255, (pos.x + pos.y * 8) * 4 + 3);
+        Graphics::Texture texture = Graphics::Texture(nullptr).Interpolation(Graphics::nearest).SetData(image);
+        fmat4 matrix = fmat4::ortho(ivec2(0, target_size.y), ivec2(target_size.x, 0), -1, 1);
+
+        // The sizes are even, so that the quad edges don't cross the pixel centers.
+        std::vector<SpriteRender::Sprite> sprites;
+        std::minstd_rand generator(42);
+        Random::Scalar<int, std::minstd_rand> rand(generator);
+        for (int i = 0; i < sprite_count; i++)
+        {
+            ivec2 size = ivec2(1 <= rand <= 3, 1 <= rand <= 3) * 2;
+            sprites.push_back({
+                .pos = ivec2(0 <= rand < target_size.x, 0 <= rand < target_size.y),
+                .size = size,
+                .tex_pos = ivec2(0 <= rand <= 8 - size.x, 0 <= rand <= 8 - size.y),
+                .tex_size = size,
+                .color = ivec3(0 <= rand <= 8, 0 <= rand <= 8, 0 <= rand <= 8) / 8.f,
+            });
+        }
+
+        Graphics::Blending::Enable();
+        Graphics::Blending::FuncNormalPre();
+        FINALLY( Graphics::Blending::Disable(); )
+
+        auto Draw = [&](auto &&func)
+        {
+            Graphics::Texture target = Graphics::Texture(nullptr).Interpolation(Graphics::nearest).SetData(target_size);
+            Graphics::FrameBuffer framebuffer(target);
+            framebuffer.Bind();
+            FINALLY( Graphics::FrameBuffer::BindDefault(); )
+            Graphics::Viewport(target_size);
+            Graphics::SetClearColor(fvec4(0));
+            Graphics::Clear();
+
+            func();
+
+            // `Graphics::FrameBuffer` only binds the draw framebuffer.
+            std::vector<u8vec4> pixels(target_size.prod());
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer.Handle());
+            FINALLY( glBindFramebuffer(GL_READ_FRAMEBUFFER, 0); )
+            glReadPixels(0, 0, target_size.x, target_size.y, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+            return pixels;
+        };
+
+        std::vector<u8vec4> expected = Draw([&]
+        {
+            Render render(0x2000, shader_config);
+            render.SetTexture(texture);
+            render.SetMatrix(matrix);
+            render.BindShader();
+            for (const SpriteRender::Sprite &sprite : sprites)
+                render.fquad(sprite.pos, sprite.size).tex(sprite.tex_pos, sprite.tex_size).center().color(sprite.color).mix(0);
+            render.Finish();
+        });
+        std::vector<u8vec4> result = Draw([&]
+        {
+            SpriteRender sprite_render(shader_config);
+            sprite_render.SetTexture(texture);
+            sprite_render.SetMatrix(matrix);
+            for (const SpriteRender::Sprite &sprite : sprites)
+                sprite_render.Add(sprite);
+            sprite_render.Finish();
+        });
+
+        if (std::all_of(expected.begin(), expected.end(), [](u8vec4 pixel){return pixel == u8vec4(0);}))
+            Program::Error("Nothing was drawn.");
+        for (std::size_t i = 0; i < expected.size(); i++)
+        {
+            if (result[i] != expected[i])
+                Program::Error(FMT("The sprite renderer doesn't match the regular renderer at pixel [{},{}].", i % target_size.x, i / target_size.x));
+        }
+    }
+
+    static void AtlasThreadPool()
+    {
+        // Builds the game atlas from the source images, with or without a thread pool. Returns the image and the description file contents.
+        auto Build = [](ThreadPool *pool, std::string name)
+        {
+            std::filesystem::path dir = std::filesystem::temp_directory_path();
+            std::string image_file = (dir / (name + ".png")).string();
+            std::string desc_file = (dir / (name + ".refl")).string();
+
+            // Remove the leftovers, so the atlas is built from scratch.
+            std::filesystem::remove(image_file);
+            std::filesystem::remove(desc_file);
+            FINALLY( std::filesystem::remove(image_file); std::filesystem::remove(desc_file); )
+
+            Graphics::TextureAtlas atlas(ivec2(2048), "assets/_images", image_file, desc_file, {{"/font_storage", ivec2(256)}}, true, pool, {}, true);
+            return std::pair(std::move(atlas.GetImage()), std::string(Stream::ReadOnlyData(desc_file).string()));
+        };
+
+        ThreadPool pool(4);
+        auto [serial_image, serial_desc] = Build(nullptr, "brimstone_test_atlas_serial");
+        auto [parallel_image, parallel_desc] = Build(&pool, "brimstone_test_atlas_parallel");
+
+        if (serial_image.Size() != parallel_image.Size() || !std::equal(serial_image.Pixels(), serial_image.Pixels() + serial_image.Size().prod(), parallel_image.Pixels()))
+            Program::Error("The atlas built with a thread pool has different pixels.");
+        if (serial_desc != parallel_desc)
+            Program::Error("The atlas built with a thread pool has a different description.");
+    }
+
+    static void AtlasBinaryCache()
+    {
+        std::filesystem::path dir = std::filesystem::temp_directory_path();
+        std::string image_file = (dir / "brimstone_test_atlas_cache.png").string();
+        std::string desc_file = (dir / "brimstone_test_atlas_cache.refl").string();
+        std::string cache_file = (dir / "brimstone_test_atlas_cache.bin").string();
+
+        auto RemoveFiles = [&]
+        {
+            std::filesystem::remove(image_file);
+            std::filesystem::remove(desc_file);
+            std::filesystem::remove(cache_file);
+        };
+        RemoveFiles();
+        FINALLY( RemoveFiles(); )
+
+        // Without a source directory, the atlas is only loaded.
+        auto Load = [&]
+        {
+            return Graphics::TextureAtlas(ivec2(2048), "", image_file, desc_file, {}, true, nullptr, {cache_file});
+        };
+
+        Graphics::TextureAtlas built(ivec2(2048), "assets/_images", image_file, desc_file, {}, true, nullptr, {cache_file});
+        const Graphics::Image &expected = built.GetImage();
+
+        auto Check = [&](const Graphics::TextureAtlas &atlas, bool expect_cache, std::string_view context)
+        {
+            if (atlas.GetBuildStats().loaded_binary_cache != expect_cache)
+                Program::Error(FMT("The binary cache was {}used {}.", expect_cache ? "not " : "", context));
+            const Graphics::Image &image = atlas.GetImage();
+            if (image.Size() != expected.Size() || !std::equal(image.Pixels(), image.Pixels() + image.Size().prod(), expected.Pixels()))
+                Program::Error(FMT("The atlas has different pixels {}.", context));
+        };
+
+        Check(Load(), true, "after building the atlas");
+
+        // Change the description file. The cache is now stale, so the atlas is loaded from the files and the cache is recreated.
+        std::string desc = std::string(Stream::ReadOnlyData(desc_file).string()) + "\n";
+        Stream::SaveFile(desc_file, desc, Stream::text);
+        Check(Load(), false, "after changing the description");
+        Check(Load(), true, "after recreating the cache");
+    }
+
+    static void RectPacking()
+    {
+        constexpr int num_iterations = 50;
+
+        std::minstd_rand generator(42);
+        Random::Scalar<int, std::minstd_rand> rand(generator);
+
+        for (int iteration = 0; iteration < num_iterations; iteration++)
+        {
+            ivec2 target_size = ivec2(64 <= rand <= 512, 64 <= rand <= 512);
+            int inner_gaps = 0 <= rand <= 2;
+            int outer_gaps = 0 <= rand <= 2;
+
+            // Sometimes more than fits.
+            std::vector<Packing::Rect> input(1 <= rand <= 200);
+            for (Packing::Rect &rect : input)
+                rect.size = ivec2(1 <= rand <= 64, 1 <= rand <= 64);
+
+            for (auto algorithm : {Packing::Algorithm::skyline_bottom_left, Packing::Algorithm::skyline_best_fit, Packing::Algorithm::max_rects_best_short_side_fit})
+            for (bool allow_rotation : {false, true})
+            {
+                Packing::Params params;
+                params.algorithm = algorithm;
+                params.allow_rotation = allow_rotation;
+                params.inner_gaps = inner_gaps;
+                params.outer_gaps = outer_gaps;
+
+                std::vector<Packing::Rect> rects = input;
+                Packing::Result result = Packing::PackRects(target_size, rects.data(), rects.size(), params);
+
+                std::string context = FMT("iteration {}, algorithm {}, rotation {}", iteration, int(algorithm), allow_rotation);
+
+                // The occupied rectangles, including the inner gaps after them.
+                std::vector<std::pair<ivec2, ivec2>> occupied; // Begin and end.
+                int not_packed = 0;
+                std::int64_t packed_area = 0;
+                ivec2 used_size = ivec2(0);
+                for (const Packing::Rect &rect : rects)
+                {
+                    if (!rect.was_packed)
+                    {
+                        not_packed++;
+                        continue;
+                    }
+                    if (rect.rotated && !allow_rotation)
+                        Program::Error(FMT("A rectangle was rotated without permission ({}).", context));
+
+                    ivec2 size = rect.rotated ? ivec2(rect.size.y, rect.size.x) : rect.size;
+                    if ((rect.pos < outer_gaps).any() || (rect.pos + size > target_size - outer_gaps).any())
+                        Program::Error(FMT("A rectangle is outside of the box ({}).", context));
+
+                    occupied.push_back({rect.pos, rect.pos + size + inner_gaps});
+                    packed_area += size.prod();
+                    clamp_var_min(used_size, rect.pos + size + outer_gaps);
+                }
+
+                for (std::size_t i = 0; i < occupied.size(); i++)
+                for (std::size_t j = i + 1; j < occupied.size(); j++)
+                {
+                    if ((occupied[i].first < occupied[j].second).all() && (occupied[j].first < occupied[i].second).all())
+                        Program::Error(FMT("Rectangles {} and {} of the packed ones overlap ({}).", i, j, context));
+                }
+
+                if (result.not_packed != not_packed)
+                    Program::Error(FMT("Wrong amount of rectangles that didn't fit ({}).", context));
+                if (occupied.empty())
+                    Program::Error(FMT("Nothing was packed ({}).", context));
+                if (result.used_size != used_size)
+                    Program::Error(FMT("Wrong used size ({}).", context));
+                if (std::abs(result.occupancy - packed_area / double(target_size.prod())) > 1e-9 || std::abs(result.used_occupancy - packed_area / double(used_size.prod())) > 1e-9)
+                    Program::Error(FMT("Wrong occupancy ({}).", context));
+            }
+        }
+    }
+
+    struct Test
+    {
+        std::string_view name;
+        void (*func)() = nullptr;
+    };
+
+    static const Test tests[] = {
+        {"corruption_determinism", CorruptionDeterminism},
+        {"two_phase_corruption", TwoPhaseCorruptionDifference},
+        {"corruption_worklist", CorruptionWorklist},
+        {"command_list_sorting", CommandListSorting},
+        {"glyph_cache", GlyphCacheEviction},
+        {"kerning_table", KerningTableFallback},
+        {"sprite_render", SpriteRenderMatchesRender},
+        {"atlas_thread_pool", AtlasThreadPool},
+        {"atlas_binary_cache", AtlasBinaryCache},
+        {"rect_packing", RectPacking},
+    };
+
+    void Run(const std::vector<std::string> &filters)
+    {
+        for (const Test &test : tests)
+        {
+            if (!filters.empty() && std::none_of(filters.begin(), filters.end(), [&](const std::string &filter){return test.name.starts_with(filter);}))
+                continue;
+
+            std::cout << test.name << ": ";
+            test.func();
+            std::cout << "OK\n";
+        }
+    }
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+// Tests for the engine and the game code. They are not a part of the normal startup.
+// Run them with `brimstone --test [names...]`.
+// The game globals aren't initialized at that point. The tests that need a GL context call `InitWindow(true)` to get a hidden window.
+namespace Tests
+{
+    // Runs the tests whose names begin with any of `filters`, or all of them if `filters` is empty.
+    // Prints "OK" after each passed test, and calls `Program::Error()` on the first failure.
+    void Run(const std::vector<std::string> &filters);
+}
@@ -48,20 +48,155 @@ void main()
     gl_FragColor.a *= v_factors.z;
 })";
 
-    Graphics::SimpleRenderQueue<Attribs, 3> queue; // Note that the queue has to be the first field.
+    static_assert(sizeof(Attribs) == sizeof(CommandList::Vertex));
+
+    Graphics::SimpleRenderQueue<Attribs, 4> queue;
     Uniforms uni;
     Graphics::Shader shader;
 
+    State state; // The current state.
+    State applied_state; // The state of the uniforms.
+    bool applied_state_valid = false;
+
+    CommandList *recording = nullptr;
+
+    Data() {} // Headless.
     Data(std::size_t queue_size, const Graphics::ShaderConfig &config) : queue(queue_size), shader("Main", config, Graphics::ShaderPreferences{}, Meta::tag<Attribs>{}, uni, vertex_source, fragment_source) {}
+
+    [[nodiscard]] static Attribs ToAttribs(const CommandList::Vertex &v)
+    {
+        return {.pos = v.pos, .color = v.color, .texcoord = v.texcoord, .factors = v.factors};
+    }
+    [[nodiscard]] static CommandList::Vertex ToVertex(const Attribs &a)
+    {
+        return {.pos = a.pos, .color = a.color, .texcoord = a.texcoord, .factors = a.factors};
+    }
+
+    // Updates the uniforms that differ from `new_state`, flushing the queue first.
+    void ApplyState(const State &new_state)
+    {
+        if (applied_state_valid && applied_state == new_state)
+            return;
+
+        queue.Flush();
+
+        if (!applied_state_valid || applied_state.texture_unit != new_state.texture_unit)
+            uni.texture.set(&new_state.texture_unit, 1);
+        if (!applied_state_valid || applied_state.texture_size != new_state.texture_size)
+            uni.tex_size = new_state.texture_size;
+        if (!applied_state_valid || !State::MatricesEqual(applied_state.matrix, new_state.matrix))
+            uni.matrix = new_state.matrix;
+        if (!applied_state_valid || !State::MatricesEqual(applied_state.color_matrix, new_state.color_matrix))
+            uni.color_matrix = new_state.color_matrix;
+
+        applied_state = new_state;
+        applied_state_valid = true;
+    }
+
+    // Call this after modifying `state`.
+    void StateChanged()
+    {
+        if (!recording)
+            ApplyState(state);
+    }
+
+    void AddQuad(const Attribs &a, const Attribs &b, const Attribs &c, const Attribs &d)
+    {
+        if (recording)
+        {
+            recording->AddQuad(state, ToVertex(a), ToVertex(b), ToVertex(c), ToVertex(d));
+            return;
+        }
+
+        if (!queue)
+            Program::Error("Attempt to draw with a headless renderer while not recording.");
+        queue.Add(a, b, c, d);
+    }
+    void AddTriangle(const Attribs &a, const Attribs &b, const Attribs &c)
+    {
+        AddQuad(a, b, c, c);
+    }
 };
 
+void Render::CommandList::AddQuad(const State &state, const Vertex &a, const Vertex &b, const Vertex &c, const Vertex &d)
+{
+    if (commands.empty() || commands.back().callback || commands.back().state != state)
+    {
+        Command &command = commands.emplace_back();
+        command.state = state;
+        command.first_quad = vertices.size() / 4;
+    }
+
+    vertices.insert(vertices.end(), {a, b, c, d});
+    commands.back().quad_count++;
+}
+
+void Render::CommandList::AddCallback(std::function<void()> callback)
+{
+    commands.emplace_back().callback = std::move(callback);
+}
+
+void Render::CommandList::SortByState()
+{
+    std::vector<Vertex> new_vertices;
+    new_vertices.reserve(vertices.size());
+    std::vector<Command> new_commands;
+    new_commands.reserve(commands.size());
+
+    auto segment_begin = commands.begin();
+    while (segment_begin != commands.end())
+    {
+        auto segment_end = std::find_if(segment_begin, commands.end(), [](const Command &command){return bool(command.callback);});
+
+        // Group the commands by state, in the order the states first appear.
+        std::size_t first_new_command = new_commands.size();
+        for (auto it = segment_begin; it != segment_end; it++)
+        {
+            auto target = std::find_if(new_commands.begin() + first_new_command, new_commands.end(), [&](const Command &command){return command.state == it->state;});
+            if (target != new_commands.end())
+                continue; // Already handled.
+
+            Command &new_command = new_commands.emplace_back();
+            new_command.state = it->state;
+            new_command.first_quad = new_vertices.size() / 4;
+            for (auto source = it; source != segment_end; source++)
+            {
+                if (source->state != it->state)
+                    continue;
+                new_vertices.insert(new_vertices.end(), vertices.begin() + source->first_quad * 4, vertices.begin() + (source->first_quad + source->quad_count) * 4);
+                new_command.quad_count += source->quad_count;
+            }
+        }
+
+        if (segment_end == commands.end())
+            break;
+        new_commands.push_back(std::move(*segment_end));
+        segment_begin = segment_end + 1;
+    }
+
+    vertices = std::move(new_vertices);
+    commands = std::move(new_commands);
+}
+
+std::size_t Render::CommandList::DrawCommandCount() const
+{
+    return std::count_if(commands.begin(), commands.end(), [](const Command &command){return !command.callback && command.quad_count > 0;});
+}
+
 void *Render::GetRenderQueuePtr()
 {
-    return &data->queue;
+    return data.get();
 }
 
 Render::Render() {}
 
+Render Render::Headless()
+{
+    Render ret;
+    ret.data = std::make_unique<Data>();
+    return ret;
+}
+
 Render::Render(std::size_t queue_size, const Graphics::ShaderConfig &config)
 {
     data = std::make_unique<Data>(queue_size, config);
@@ -75,7 +210,7 @@ Render::~Render() = default;
 
 Render::operator bool() const
 {
-    return bool(data->shader);
+    return data && bool(data->shader);
 }
 
 void Render::BindShader() const
@@ -88,16 +223,86 @@ void Render::Finish()
     data->queue.Flush();
 }
 
+Render::QueueStats Render::TakeQueueStats()
+{
+    const auto &stats = data->queue.GetStats();
+    QueueStats ret{.flushes = stats.flushes, .bytes_uploaded = stats.bytes_uploaded, .orphans = stats.orphans};
+    data->queue.ResetStats();
+    return ret;
+}
+
+void Render::BeginRecording(CommandList &list)
+{
+    ASSERT(!data->recording, "Already recording.");
+    data->recording = &list;
+}
+
+void Render::EndRecording()
+{
+    ASSERT(data->recording, "Not recording.");
+    data->recording = nullptr;
+    data->StateChanged();
+}
+
+bool Render::IsRecording() const
+{
+    return data->recording;
+}
+
+void Render::Callback(std::function<void()> func)
+{
+    if (data->recording)
+    {
+        data->recording->AddCallback(std::move(func));
+    }
+    else
+    {
+        Finish();
+        func();
+    }
+}
+
+void Render::Submit(const CommandList &list)
+{
+    ASSERT(!data->recording, "Can't submit commands while recording.");
+    if (!data->queue)
+        Program::Error("Attempt to submit commands to a headless renderer.");
+
+    for (const CommandList::Command &command : list.commands)
+    {
+        if (command.callback)
+        {
+            Finish();
+            command.callback();
+            continue;
+        }
+
+        data->ApplyState(command.state);
+        for (std::size_t i = command.first_quad * 4; i < (command.first_quad + command.quad_count) * 4; i += 4)
+        {
+            const CommandList::Vertex *v = &list.vertices[i];
+            data->queue.Add(Data::ToAttribs(v[0]), Data::ToAttribs(v[1]), Data::ToAttribs(v[2]), Data::ToAttribs(v[3]));
+        }
+    }
+
+    data->ApplyState(data->state);
+}
+
+const Render::State &Render::GetState() const
+{
+    return data->state;
+}
+
 void Render::SetTextureUnit(const Graphics::TexUnit &unit)
 {
-    Finish();
-    data->uni.texture = unit;
+    data->state.texture_unit = unit.Index();
+    data->StateChanged();
 }
 
 void Render::SetTextureSize(ivec2 size)
 {
-    Finish();
-    data->uni.tex_size = size;
+    data->state.texture_size = size;
+    data->StateChanged();
 }
 
 void Render::SetTexture(const Graphics::Texture &tex)
@@ -108,17 +313,18 @@ void Render::SetTexture(const Graphics::Texture &tex)
 
 void Render::SetMatrix(const fmat4 &m)
 {
-    Finish();
-    data->uni.matrix = m;
+    data->state.matrix = m;
+    data->StateChanged();
 }
 
 void Render::SetColorMatrix(const fmat4 &m)
 {
-    Finish();
-    data->uni.color_matrix = m;
+    data->state.color_matrix = m;
+    data->StateChanged();
 }
 
-Render::Quad_t::~Quad_t()
+template <bool Uniform>
+Render::BasicQuad_t<Uniform>::~BasicQuad_t()
 {
     if (!queue)
         return;
@@ -136,34 +342,55 @@ Render::Quad_t::~Quad_t()
 
     Render::Data::Attribs out[4];
 
-    if (data.has_texture)
+    if constexpr (Uniform)
     {
-        for (int i = 0; i < 4; i++)
+        // All corners get the same color and factors, so compute them once.
+        Render::Data::Attribs vertex;
+        if (data.has_texture)
         {
-            out[i].color = data.colors[i].to_vec4(0);
-            out[i].factors.x = data.tex_color_factors[i];
-            out[i].factors.y = data.alpha[i];
+            vertex.color = data.colors[0].to_vec4(0);
+            vertex.factors = fvec3(data.tex_color_factors[0], data.alpha[0], data.beta[0]);
         }
-
-        if (data.center_pos_tex)
+        else
         {
-            if (data.tex_size.x)
-                data.center.x *= data.size.x / data.tex_size.x;
-            if (data.tex_size.y)
-                data.center.y *= data.size.y / data.tex_size.y;
+            vertex.color = data.colors[0].to_vec4(data.alpha[0]);
+            vertex.factors = fvec3(0, 0, data.beta[0]);
         }
+
+        for (auto &it : out)
+            it = vertex;
     }
     else
     {
-        for (int i = 0; i < 4; i++)
+        if (data.has_texture)
         {
-            out[i].color = data.colors[i].to_vec4(data.alpha[i]);
-            out[i].factors.x = out[i].factors.y = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                out[i].color = data.colors[i].to_vec4(0);
+                out[i].factors.x = data.tex_color_factors[i];
+                out[i].factors.y = data.alpha[i];
+            }
         }
+        else
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                out[i].color = data.colors[i].to_vec4(data.alpha[i]);
+                out[i].factors.x = out[i].factors.y = 0;
+            }
+        }
+
+        for (int i = 0; i < 4; i++)
+            out[i].factors.z = data.beta[i];
     }
 
-    for (int i = 0; i < 4; i++)
-        out[i].factors.z = data.beta[i];
+    if (data.has_texture && data.center_pos_tex)
+    {
+        if (data.tex_size.x)
+            data.center.x *= data.size.x / data.tex_size.x;
+        if (data.tex_size.y)
+            data.center.y *= data.size.y / data.tex_size.y;
+    }
 
     if (data.flip_x)
     {
@@ -185,7 +412,7 @@ Render::Quad_t::~Quad_t()
     out[1].pos = fvec2(out[2].pos.x, out[0].pos.y);
     out[3].pos = fvec2(out[0].pos.x, out[2].pos.y);
 
-    if (data.has_matrix)
+    if (!Uniform && data.has_matrix)
     {
         for (auto &it : out)
             it.pos = data.pos + (data.matrix * it.pos.to_vec3(1)).to_vec2();
@@ -201,9 +428,12 @@ Render::Quad_t::~Quad_t()
     out[1].texcoord = {out[2].texcoord.x, out[0].texcoord.y};
     out[3].texcoord = {out[0].texcoord.x, out[2].texcoord.y};
 
-    ((decltype(Render::Data::queue) *)queue)->Add(out[0], out[1], out[2], out[3]);
+    ((Render::Data *)queue)->AddQuad(out[0], out[1], out[2], out[3]);
 }
 
+template Render::BasicQuad_t<false>::~BasicQuad_t();
+template Render::BasicQuad_t<true>::~BasicQuad_t();
+
 Render::Triangle_t::~Triangle_t()
 {
     if (!queue)
@@ -247,49 +477,130 @@ Render::Triangle_t::~Triangle_t()
             it.pos = (data.matrix * it.pos.to_vec3(1)).to_vec2();
     }
 
-    ((decltype(Render::Data::queue) *)queue)->Add(out[0], out[1], out[2]);
+    ((Render::Data *)queue)->AddTriangle(out[0], out[1], out[2]);
 }
 
-Render::Text_t::~Text_t()
+// Lays out `text`, calling `func(offset, symbol)` for every symbol. The offsets are relative to the text position.
+// `align` and `align_box_x` have the same meaning as in `Render::Text_t`. Returns the text stats, which are computed anyway.
+template <typename F>
+static Graphics::Text::Stats LayOutText(const Graphics::Text &text, ivec2 align, int align_box_x, F &&func)
 {
-    if (!renderer)
-        return;
-
-    Graphics::Text::Stats stats = data.text.ComputeStats();
+    Graphics::Text::Stats stats = text.ComputeStats();
 
-    ivec2 align_box(data.has_box_alignment ? data.align_box_x : data.align.x, data.align.y);
-
-    fvec2 pos = data.pos;
+    align = sign(align);
+    ivec2 align_box(sign(align_box_x), align.y);
 
     fvec2 offset = -stats.size * (1 + align_box) / 2;
-    offset.x += stats.size.x * (1 + data.align.x) / 2; // Note that we don't change vertical position here.
+    offset.x += stats.size.x * (1 + align.x) / 2; // Note that we don't change vertical position here.
 
     float line_start_offset_x = offset.x;
 
-    for (size_t line_index = 0; line_index < data.text.lines.size(); line_index++)
+    for (size_t line_index = 0; line_index < text.lines.size(); line_index++)
     {
-        const Graphics::Text::Line &line = data.text.lines[line_index];
+        const Graphics::Text::Line &line = text.lines[line_index];
         const Graphics::Text::Stats::Line &line_stats = stats.lines[line_index];
 
-        offset.x = line_start_offset_x - line_stats.width * (1 + data.align.x) / 2;
+        offset.x = line_start_offset_x - line_stats.width * (1 + align.x) / 2;
         offset.y += line_stats.ascent;
 
         for (const Graphics::Text::Symbol &symbol : line.symbols)
         {
-            fvec2 symbol_pos;
+            func(offset + symbol.offset, symbol);
+            offset.x += symbol.advance + symbol.kerning;
+        }
 
-            if (!data.has_matrix)
-                symbol_pos = pos + offset + symbol.offset;
-            else
-                symbol_pos = pos + (data.matrix * (offset + symbol.offset).to_vec3(1)).to_vec2();
+        offset.y += line_stats.descent + line_stats.line_gap;
+    }
 
-            auto quad = renderer->fquad(symbol_pos, symbol.size).tex(symbol.texture_pos).color(data.color).mix(0).alpha(data.alpha).beta(data.beta);
-            if (data.has_matrix)
-                quad.matrix(data.matrix.to_mat2()).pixel_center(fvec2(0));
+    return stats;
+}
 
-            offset.x += symbol.advance + symbol.kerning;
+void Render::PreparedText::LayOut(const Graphics::Text &text) const
+{
+    vertices.clear();
+    size = LayOutText(text, align, align_box_x, [&](fvec2 offset, const Graphics::Text::Symbol &symbol)
+    {
+        // Same corners as `fquad(offset, symbol.size).tex(symbol.texture_pos)`.
+        fvec2 a = offset, b = offset + symbol.size;
+        fvec2 tex_a = symbol.texture_pos, tex_b = symbol.texture_pos + symbol.size;
+        vertices.insert(vertices.end(), {{a, tex_a}, {fvec2(b.x, a.y), fvec2(tex_b.x, tex_a.y)}, {b, tex_b}, {fvec2(a.x, b.y), fvec2(tex_a.x, tex_b.y)}});
+    }).size;
+}
+
+void Render::PreparedText::UpdateIfStale() const
+{
+    if (!font || font->Generation() == font_generation)
+        return;
+
+    font_generation = font->Generation();
+    LayOut(Graphics::Text(*font, string));
+}
+
+Render::PreparedText::PreparedText(const Graphics::Text &text, ivec2 align, int align_box_x)
+    : align(align), align_box_x(align_box_x)
+{
+    LayOut(text);
+}
+
+Render::PreparedText::PreparedText(const Graphics::Font &font, std::string_view str, ivec2 align, int align_box_x)
+    : font(&font), string(str), align(align), align_box_x(align_box_x), font_generation(font.Generation())
+{
+    LayOut(Graphics::Text(font, string));
+}
+
+void Render::Text_t::EmitGlyph(fvec2 offset, fvec2 size, fvec2 texture_pos)
+{
+    fvec2 symbol_pos;
+
+    if (!data.has_matrix)
+        symbol_pos = data.pos + offset;
+    else
+        symbol_pos = data.pos + (data.matrix * offset.to_vec3(1)).to_vec2();
+
+    auto quad = renderer->fquad(symbol_pos, size).tex(texture_pos).color(data.color).mix(0).alpha(data.alpha).beta(data.beta);
+    if (data.has_matrix)
+        quad.matrix(data.matrix.to_mat2()).pixel_center(fvec2(0));
+}
+
+void Render::Text_t::EmitPrepared()
+{
+    const std::vector<PreparedText::Vertex> &vertices = data.prepared->Vertices();
+
+    // Same as what `EmitGlyph()` produces, but only the positions differ between the glyphs.
+    Render::Data::Attribs out[4];
+    for (auto &it : out)
+    {
+        it.color = data.color.to_vec4(0);
+        it.factors = fvec3(0, data.alpha, data.beta);
+    }
+
+    for (std::size_t i = 0; i < vertices.size(); i += 4)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            const PreparedText::Vertex &v = vertices[i + j];
+            out[j].pos = data.pos + (data.has_matrix ? (data.matrix * v.pos.to_vec3(1)).to_vec2() : v.pos);
+            out[j].texcoord = v.texcoord;
         }
+        renderer->data->AddQuad(out[0], out[1], out[2], out[3]);
+    }
+}
 
-        offset.y += line_stats.descent + line_stats.line_gap;
+Render::Text_t::~Text_t()
+{
+    if (!renderer)
+        return;
+
+    if (data.prepared)
+    {
+        EmitPrepared();
+    }
+    else
+    {
+        // Non-prepared texts are emitted directly, without storing the layout.
+        LayOutText(data.text, data.align, data.has_box_alignment ? data.align_box_x : data.align.x, [&](fvec2 offset, const Graphics::Text::Symbol &symbol)
+        {
+            EmitGlyph(offset, symbol.size, symbol.texture_pos);
+        });
     }
 }
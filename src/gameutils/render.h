@@ -1,7 +1,13 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <string>
+#include <string_view>
 #include <utility>
+#include <vector>
 
 #include "graphics/text.h"
 #include "graphics/texture_atlas.h"
@@ -23,9 +29,121 @@ class Render
     void *GetRenderQueuePtr();
 
   public:
+    // The state the draw commands depend on.
+    struct State
+    {
+        int texture_unit = -1; // The index of the texture unit.
+        ivec2 texture_size = ivec2(0);
+        fmat4 matrix, color_matrix;
+
+        [[nodiscard]] static bool MatricesEqual(const fmat4 &a, const fmat4 &b)
+        {
+            return a.x == b.x && a.y == b.y && a.z == b.z && a.w == b.w;
+        }
+
+        [[nodiscard]] bool operator==(const State &other) const
+        {
+            return texture_unit == other.texture_unit && texture_size == other.texture_size && MatricesEqual(matrix, other.matrix) && MatricesEqual(color_matrix, other.color_matrix);
+        }
+    };
+
+    // A list of draw commands recorded on the CPU, see `BeginRecording()`.
+    // Doesn't need a GL context, so the generated vertices can be inspected without one.
+    class CommandList
+    {
+      public:
+        // Same layout as the vertex shader attributes.
+        struct Vertex
+        {
+            fvec2 pos;
+            fvec4 color;
+            fvec2 texcoord;
+            fvec3 factors;
+        };
+
+        struct Command
+        {
+            // If set, this command calls the function instead of drawing.
+            // This is used for the state changes `Render` doesn't know about, such as blending and binding framebuffers.
+            std::function<void()> callback;
+
+            State state;
+            std::size_t first_quad = 0, quad_count = 0; // In `vertices`, measured in quads.
+        };
+
+        // Each quad is 4 vertices. Triangles are stored as degenerate quads, with the last vertex repeated.
+        std::vector<Vertex> vertices;
+        std::vector<Command> commands;
+
+        void Clear()
+        {
+            vertices.clear();
+            commands.clear();
+        }
+
+        // Appends a quad. Merges it into the last command if the state is the same.
+        void AddQuad(const State &state, const Vertex &a, const Vertex &b, const Vertex &c, const Vertex &d);
+
+        void AddCallback(std::function<void()> callback);
+
+        // Reorders the draw commands between each pair of callbacks, so that the ones with the same state become adjacent and can be merged.
+        // The order of the quads with the same state is preserved, but otherwise the drawing order changes,
+        //   so only use this if the differently textured quads don't overlap, or if the order doesn't matter.
+        void SortByState();
+
+        // How many draw calls `Render::Submit()` will need at least, ignoring the queue overflows.
+        [[nodiscard]] std::size_t DrawCommandCount() const;
+    };
+
+    // A text with a precomputed layout, for the texts that are drawn many times without changes.
+    // Stores the finished glyph vertices relative to the text position, so drawing it only needs to copy and translate them.
+    // Draw it with `itext()` or `ftext()`. The alignment is fixed when the layout is computed.
+    class PreparedText
+    {
+      public:
+        // The color and the factors are added when drawing.
+        struct Vertex
+        {
+            fvec2 pos; // Relative to the text position.
+            fvec2 texcoord;
+        };
+
+      private:
+        // Only set if constructed from a font and a string. Then the layout is redone when `font->Generation()` changes.
+        const Graphics::Font *font = nullptr;
+        std::string string;
+        ivec2 align = ivec2(0);
+        int align_box_x = 0;
+
+        // Those are mutable to redo the layout on access.
+        mutable std::uint64_t font_generation = 0;
+        mutable std::vector<Vertex> vertices; // 4 per glyph, in the same order as the quad corners.
+        mutable ivec2 size = ivec2(0);
+
+        void LayOut(const Graphics::Text &text) const;
+        // Redoes the layout if the glyphs of `font` have changed since it was computed.
+        void UpdateIfStale() const;
+
+      public:
+        PreparedText() {}
+        // `align` and `align_box_x` have the same meaning as in `Text_t`. By default the box is aligned the same way as the text.
+        PreparedText(const Graphics::Text &text, ivec2 align = ivec2(0)) : PreparedText(text, align, align.x) {}
+        PreparedText(const Graphics::Text &text, ivec2 align, int align_box_x);
+        // Lays out `str` with `font`, and redoes the layout when the glyphs of the font change, e.g. when `Graphics::GlyphCache` evicts them.
+        // The font must outlive this object.
+        PreparedText(const Graphics::Font &font, std::string_view str, ivec2 align = ivec2(0)) : PreparedText(font, str, align, align.x) {}
+        PreparedText(const Graphics::Font &font, std::string_view str, ivec2 align, int align_box_x);
+
+        [[nodiscard]] const std::vector<Vertex> &Vertices() const {UpdateIfStale(); return vertices;}
+        [[nodiscard]] ivec2 Size() const {UpdateIfStale(); return size;}
+    };
+
     Render();
     Render(std::size_t queue_size, const Graphics::ShaderConfig &config);
 
+    // Creates a renderer without a GL context. It can only record commands, see `BeginRecording()`.
+    [[nodiscard]] static Render Headless();
+
     Render(Render &&) noexcept;
     Render &operator=(Render &&) noexcept;
     ~Render();
@@ -36,6 +154,33 @@ class Render
 
     void Finish();
 
+    struct QueueStats
+    {
+        std::size_t flushes = 0;
+        std::size_t bytes_uploaded = 0;
+        std::size_t orphans = 0; // How many times the vertex buffer storage was replaced.
+    };
+    // Returns the queue counters accumulated since the last call, and resets them.
+    // Call it once per frame to get the per-frame numbers.
+    [[nodiscard]] QueueStats TakeQueueStats();
+
+    // Until `EndRecording()`, the quads, triangles and texts are appended to `list` instead of being drawn,
+    //   and the state changes are only remembered, without touching the GL state.
+    // `list` must remain alive until `EndRecording()`.
+    void BeginRecording(CommandList &list);
+    void EndRecording();
+    [[nodiscard]] bool IsRecording() const;
+
+    // If recording, records `func` as a command. Otherwise calls `Finish()` and then `func` immediately.
+    // Use this for the state changes that `Render` doesn't manage, such as blending and binding framebuffers.
+    void Callback(std::function<void()> func);
+
+    // Draws the commands, then restores the current state.
+    void Submit(const CommandList &list);
+
+    // The current state, as set by the functions below.
+    [[nodiscard]] const State &GetState() const;
+
     void SetTextureUnit(const Graphics::TexUnit &unit);
     void SetTextureUnit(Graphics::TexUnit &&) = delete;
 
@@ -48,59 +193,78 @@ class Render
 
     void SetColorMatrix(const fmat4 &m);
 
-    class Quad_t
+  private:
+    // The parameters of `BasicQuad_t`.
+    struct QuadData
     {
-        friend class Render;
+        fvec2 pos, size; // The constructor sets these.
 
-        using ref = Quad_t &&;
+        bool has_texture = 0;
+        fvec2 tex_pos = fvec2(0), tex_size = fvec2(0);
 
-        void *queue = 0; // Actually the type should be `Graphics::SimpleRenderQueue<Attribs, 3> *`, but we don't include "graphics/simple_render_queue.h" for better compilation times.
+        bool has_center = 0;
+        fvec2 center = fvec2(0);
+        bool center_pos_tex = 0;
 
-        struct Data
-        {
-            fvec2 pos, size; // The constructor sets these.
+        bool has_matrix = 0;
+        fmat3 matrix = fmat3();
 
-            bool has_texture = 0;
-            fvec2 tex_pos = fvec2(0), tex_size = fvec2(0);
+        bool has_color = 0;
+        fvec3 colors[4] {};
 
-            bool has_center = 0;
-            fvec2 center = fvec2(0);
-            bool center_pos_tex = 0;
+        bool has_tex_color_fac = 0;
+        float tex_color_factors[4] = {1,1,1,1};
 
-            bool has_matrix = 0;
-            fmat3 matrix = fmat3();
+        float alpha[4] = {1,1,1,1};
+        float beta[4] = {1,1,1,1};
 
-            bool has_color = 0;
-            fvec3 colors[4] {};
+        bool abs_pos = 0;
+        bool abs_tex_pos = 0;
 
-            bool has_tex_color_fac = 0;
-            float tex_color_factors[4] = {1,1,1,1};
+        bool flip_x = 0, flip_y = 0;
+    };
 
-            float alpha[4] = {1,1,1,1};
-            float beta[4] = {1,1,1,1};
+  public:
+    // Builds a quad, which is drawn when this object is destroyed.
+    // If `Uniform` is true, the quad can't have a matrix, and has the same color, factors, alpha and beta at all corners.
+    //   This lets the destructor skip most of the per-corner work. `fquad()` and `iquad()` return such quads,
+    //   and the functions that need a general quad (the matrices and the per-corner parameters) convert it to one.
+    template <bool Uniform>
+    class BasicQuad_t
+    {
+        friend class Render;
+        friend class BasicQuad_t<!Uniform>;
 
-            bool abs_pos = 0;
-            bool abs_tex_pos = 0;
+        using ref = BasicQuad_t &&;
 
-            bool flip_x = 0, flip_y = 0;
-        };
+        void *queue = 0; // Actually the type should be `Render::Data *`, but it's incomplete here.
+
+        using Data = QuadData;
         Data data;
 
-        Quad_t(void *queue, fvec2 pos, fvec2 size) : queue(queue)
+        BasicQuad_t(void *queue, fvec2 pos, fvec2 size) : queue(queue)
         {
             data.pos = pos;
             data.size = size;
         }
+        BasicQuad_t(void *queue, const Data &data) : queue(queue), data(data) {}
+
+        // Converts a uniform quad to a general one, which is drawn instead of this one.
+        [[nodiscard]] BasicQuad_t<false> general() requires Uniform
+        {
+            return BasicQuad_t<false>(std::exchange(queue, {}), data);
+        }
+
       public:
-        Quad_t(Quad_t &&other) noexcept : queue(std::exchange(other.queue, {})), data(std::move(other.data)) {}
-        Quad_t &operator=(Quad_t other) noexcept
+        BasicQuad_t(BasicQuad_t &&other) noexcept : queue(std::exchange(other.queue, {})), data(std::move(other.data)) {}
+        BasicQuad_t &operator=(BasicQuad_t other) noexcept
         {
             std::swap(queue, other.queue);
             std::swap(data, other.data);
             return *this;
         }
 
-        ~Quad_t();
+        ~BasicQuad_t();
 
         ref tex(fvec2 pos, fvec2 size)
         {
@@ -139,7 +303,11 @@ class Render
             pixel_center(data.size / 2);
             return (ref)*this;
         }
-        ref matrix(fmat3 m) // This can be called multiple times, resulting in multiplying matrices in the order they were passed.
+        BasicQuad_t<false> matrix(fmat3 m) requires Uniform
+        {
+            return general().matrix(m);
+        }
+        ref matrix(fmat3 m) requires (!Uniform) // This can be called multiple times, resulting in multiplying matrices in the order they were passed.
         {
             if (data.has_matrix)
             {
@@ -152,27 +320,47 @@ class Render
             }
             return (ref)*this;
         }
-        ref matrix(fmat2 m)
+        BasicQuad_t<false> matrix(fmat2 m) requires Uniform
+        {
+            return general().matrix(m);
+        }
+        ref matrix(fmat2 m) requires (!Uniform)
         {
             matrix(m.to_mat3());
             return (ref)*this;
         }
-        ref rotate(float a) // Uses `matrix()`.
+        BasicQuad_t<false> rotate(float a) requires Uniform
+        {
+            return general().rotate(a);
+        }
+        ref rotate(float a) requires (!Uniform) // Uses `matrix()`.
         {
             matrix(fmat3::rotate(a));
             return (ref)*this;
         }
-        ref translate(fvec2 v) // Uses a matrix.
+        BasicQuad_t<false> translate(fvec2 v) requires Uniform
+        {
+            return general().translate(v);
+        }
+        ref translate(fvec2 v) requires (!Uniform) // Uses a matrix.
         {
             matrix(fmat3::translate(v));
             return (ref)*this;
         }
-        ref scale(fvec2 s) // Uses a matrix.
+        BasicQuad_t<false> scale(fvec2 s) requires Uniform
+        {
+            return general().scale(s);
+        }
+        ref scale(fvec2 s) requires (!Uniform) // Uses a matrix.
         {
             matrix(fmat3::scale(s));
             return (ref)*this;
         }
-        ref scale(float s) // Uses a matrix.
+        BasicQuad_t<false> scale(float s) requires Uniform
+        {
+            return general().scale(s);
+        }
+        ref scale(float s) requires (!Uniform) // Uses a matrix.
         {
             scale(fvec2(s));
             return (ref)*this;
@@ -186,7 +374,11 @@ class Render
                 it = c;
             return (ref)*this;
         }
-        ref color(fvec3 a, fvec3 b, fvec3 c, fvec3 d)
+        BasicQuad_t<false> color(fvec3 a, fvec3 b, fvec3 c, fvec3 d) requires Uniform
+        {
+            return general().color(a, b, c, d);
+        }
+        ref color(fvec3 a, fvec3 b, fvec3 c, fvec3 d) requires (!Uniform)
         {
             ASSERT(!data.has_color, "2D poly renderer: Quad_t color specified twice.");
             data.has_color = 1;
@@ -206,7 +398,11 @@ class Render
                 it = x;
             return (ref)*this;
         }
-        ref mix(float a, float b, float c, float d)
+        BasicQuad_t<false> mix(float a, float b, float c, float d) requires Uniform
+        {
+            return general().mix(a, b, c, d);
+        }
+        ref mix(float a, float b, float c, float d) requires (!Uniform)
         {
             ASSERT(!data.has_tex_color_fac, "2D poly renderer: Quad_t texture/color factor specified twice.");
             data.has_tex_color_fac = 1;
@@ -223,7 +419,11 @@ class Render
                 it = a;
             return (ref)*this;
         }
-        ref alpha(float a, float b, float c, float d)
+        BasicQuad_t<false> alpha(float a, float b, float c, float d) requires Uniform
+        {
+            return general().alpha(a, b, c, d);
+        }
+        ref alpha(float a, float b, float c, float d) requires (!Uniform)
         {
             data.alpha[0] = a;
             data.alpha[1] = b;
@@ -237,7 +437,11 @@ class Render
                 it = a;
             return (ref)*this;
         }
-        ref beta(float a, float b, float c, float d)
+        BasicQuad_t<false> beta(float a, float b, float c, float d) requires Uniform
+        {
+            return general().beta(a, b, c, d);
+        }
+        ref beta(float a, float b, float c, float d) requires (!Uniform)
         {
             data.beta[0] = a;
             data.beta[1] = b;
@@ -267,13 +471,16 @@ class Render
         }
     };
 
+    using Quad_t = BasicQuad_t<false>;
+    using UniformQuad_t = BasicQuad_t<true>;
+
     class Triangle_t
     {
         friend class Render;
 
         using ref = Triangle_t &&;
 
-        void *queue = 0; // Actually the type should be `Graphics::SimpleRenderQueue<Attribs, 3> *`, but we don't include "graphics/simple_render_queue.h" for better compilation times.
+        void *queue = 0; // Actually the type should be `Render::Data *`, but it's incomplete here.
 
         struct Data
         {
@@ -426,6 +633,7 @@ class Render
             // The constructor sets those:
             fvec2 pos;
             Graphics::Text text;
+            const PreparedText *prepared = nullptr; // If set, `text` is unused and the alignment can't be changed.
 
             ivec2 align = ivec2(0);
 
@@ -441,11 +649,21 @@ class Render
         };
         Data data;
 
+        // `offset` is relative to the text position.
+        void EmitGlyph(fvec2 offset, fvec2 size, fvec2 texture_pos);
+        // Draws `data.prepared` by copying its vertices.
+        void EmitPrepared();
+
         Text_t(Render *renderer, fvec2 pos, Graphics::Text text) : renderer(renderer)
         {
             data.pos = pos;
             data.text = std::move(text);
         }
+        Text_t(Render *renderer, fvec2 pos, const PreparedText &prepared) : renderer(renderer)
+        {
+            data.pos = pos;
+            data.prepared = &prepared;
+        }
       public:
         Text_t(Text_t &&other) noexcept : renderer(std::exchange(other.renderer, {})), data(std::move(other.data)) {}
         Text_t &operator=(Text_t other)
@@ -472,27 +690,32 @@ class Render
         }
         ref align(ivec2 a)
         {
+            ASSERT(!data.prepared, "2D poly renderer: The alignment of a prepared text can't be changed.");
             data.align = sign(a);
             return (ref)*this;
         }
         ref align_x(int x)
         {
+            ASSERT(!data.prepared, "2D poly renderer: The alignment of a prepared text can't be changed.");
             data.align.x = sign(x);
             return (ref)*this;
         }
         ref align_y(int y)
         {
+            ASSERT(!data.prepared, "2D poly renderer: The alignment of a prepared text can't be changed.");
             data.align.y = sign(y);
             return (ref)*this;
         }
         ref align_box_x(int x)
         {
+            ASSERT(!data.prepared, "2D poly renderer: The alignment of a prepared text can't be changed.");
             data.has_box_alignment = 1;
             data.align_box_x = sign(x);
             return (ref)*this;
         }
         ref align(ivec2 align_text, int align_box)
         {
+            ASSERT(!data.prepared, "2D poly renderer: The alignment of a prepared text can't be changed.");
             data.align = sign(align_text);
             data.has_box_alignment = 1;
             data.align_box_x = align_box;
@@ -540,24 +763,24 @@ class Render
         ~Text_t();
     };
 
-    Quad_t fquad(fvec2 pos, fvec2 size)
+    UniformQuad_t fquad(fvec2 pos, fvec2 size)
     {
-        return Quad_t(GetRenderQueuePtr(), pos, size);
+        return UniformQuad_t(GetRenderQueuePtr(), pos, size);
     }
 
-    Quad_t iquad(fvec2 pos, fvec2 size) = delete;
-    Quad_t iquad(ivec2 pos, ivec2 size)
+    UniformQuad_t iquad(fvec2 pos, fvec2 size) = delete;
+    UniformQuad_t iquad(ivec2 pos, ivec2 size)
     {
-        return Quad_t(GetRenderQueuePtr(), pos, size);
+        return UniformQuad_t(GetRenderQueuePtr(), pos, size);
     }
 
-    Quad_t fquad(fvec2 pos, const Graphics::TextureAtlas::Region &image)
+    UniformQuad_t fquad(fvec2 pos, const Graphics::TextureAtlas::Region &image)
     {
         return fquad(pos, image.size).tex(image.pos);
     }
 
-    Quad_t iquad(fvec2 pos, const Graphics::TextureAtlas::Region &image) = delete;
-    Quad_t iquad(ivec2 pos, const Graphics::TextureAtlas::Region &image)
+    UniformQuad_t iquad(fvec2 pos, const Graphics::TextureAtlas::Region &image) = delete;
+    UniformQuad_t iquad(ivec2 pos, const Graphics::TextureAtlas::Region &image)
     {
         return fquad(pos, image);
     }
@@ -582,4 +805,15 @@ class Render
     {
         return Text_t(this, pos, std::move(text));
     }
+    Text_t ftext(fvec2 pos, const PreparedText &text)
+    {
+        return Text_t(this, pos, text);
+    }
+    Text_t ftext(fvec2 pos, const PreparedText &&text) = delete;
+    Text_t itext(fvec2 pos, const PreparedText &text) = delete;
+    Text_t itext(ivec2 pos, const PreparedText &text)
+    {
+        return Text_t(this, pos, text);
+    }
+    Text_t itext(ivec2 pos, const PreparedText &&text) = delete;
 };
@@ -0,0 +1,136 @@
+#include "sprite_render.h"
+
+#include <vector>
+
+#include "graphics/complete.h"
+#include "reflection/structs.h"
+
+struct SpriteRender::Data
+{
+    // Each sprite is stored as 3 texels of the buffer texture: `(pos, size)`, `(tex_pos, tex_size)`, `(color, unused)`.
+    static constexpr int texels_per_sprite = 3;
+    // OpenGL guarantees that buffer textures can have at least 65536 texels.
+    static constexpr int sprites_per_batch = 65536 / texels_per_sprite;
+
+    REFL_SIMPLE_STRUCT( Uniforms
+        REFL_DECL(Graphics::Uniform<fmat4> REFL_ATTR Graphics::Vert) matrix
+        REFL_DECL(Graphics::Uniform<fvec2> REFL_ATTR Graphics::Vert) tex_size
+        REFL_DECL(Graphics::Uniform<Graphics::TexUnit> REFL_ATTR Graphics::Frag) texture
+    )
+
+    // `u_sprites` is declared manually, since the uniform reflection only knows 2D samplers.
+    static constexpr const char *vertex_source = R"(
+uniform samplerBuffer u_sprites;
+varying vec3 v_color;
+varying vec2 v_texcoord;
+void main()
+{
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    vec4 pos_size = texelFetch(u_sprites, gl_InstanceID * 3);
+    vec4 tex_pos_size = texelFetch(u_sprites, gl_InstanceID * 3 + 1);
+    gl_Position = u_matrix * vec4(pos_size.xy + pos_size.zw * (corner - 0.5), 0, 1);
+    v_color     = texelFetch(u_sprites, gl_InstanceID * 3 + 2).rgb;
+    v_texcoord  = (tex_pos_size.xy + tex_pos_size.zw * corner) / u_tex_size;
+})";
+
+    static constexpr const char *fragment_source = R"(
+varying vec3 v_color;
+varying vec2 v_texcoord;
+void main()
+{
+    float alpha = texture2D(u_texture, v_texcoord).a;
+    gl_FragColor = vec4(v_color * alpha, alpha);
+})";
+
+    std::vector<fvec4> queue;
+    Uniforms uni;
+    Graphics::Shader shader;
+
+    // The sprite records are uploaded to this buffer, which is exposed to the shader as a buffer texture.
+    Graphics::VertexBuffer<fvec4> buffer;
+    Graphics::TexObject buffer_texture;
+    Graphics::TexUnit buffer_unit;
+
+    Data(const Graphics::ShaderConfig &config)
+        : shader("Sprites", config, Graphics::ShaderPreferences{}, Meta::tag<Graphics::none_t>{}, uni, vertex_source, fragment_source),
+        buffer(nullptr), buffer_texture(nullptr), buffer_unit(nullptr)
+    {
+        queue.reserve(sprites_per_batch * texels_per_sprite);
+
+        // The texture refers to the buffer object rather than to its storage, so it doesn't need to be updated when the storage is replaced.
+        buffer.SetData(0, nullptr, Graphics::stream_draw);
+        buffer_unit.Activate();
+        glBindTexture(GL_TEXTURE_BUFFER, buffer_texture.Handle());
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer.Handle());
+
+        shader.Bind();
+        glUniform1i(glGetUniformLocation(shader.Handle(), "u_sprites"), buffer_unit.Index());
+    }
+};
+
+SpriteRender::SpriteRender() {}
+
+SpriteRender::SpriteRender(const Graphics::ShaderConfig &config)
+{
+    data = std::make_unique<Data>(config);
+    SetMatrix(fmat4());
+}
+
+SpriteRender::SpriteRender(SpriteRender &&) noexcept = default;
+SpriteRender &SpriteRender::operator=(SpriteRender &&) noexcept = default;
+SpriteRender::~SpriteRender() = default;
+
+SpriteRender::operator bool() const
+{
+    return data && bool(data->shader);
+}
+
+void SpriteRender::SetTextureUnit(const Graphics::TexUnit &unit)
+{
+    Finish();
+    data->uni.texture = unit;
+}
+
+void SpriteRender::SetTextureSize(ivec2 size)
+{
+    Finish();
+    data->uni.tex_size = size;
+}
+
+void SpriteRender::SetTexture(const Graphics::Texture &tex)
+{
+    SetTextureUnit(tex);
+    SetTextureSize(tex.Size());
+}
+
+void SpriteRender::SetMatrix(const fmat4 &m)
+{
+    Finish();
+    data->uni.matrix = m;
+}
+
+void SpriteRender::Add(const Sprite &sprite)
+{
+    if (data->queue.size() >= Data::sprites_per_batch * Data::texels_per_sprite)
+        Finish();
+
+    data->queue.push_back(fvec4(sprite.pos.x, sprite.pos.y, sprite.size.x, sprite.size.y));
+    data->queue.push_back(fvec4(sprite.tex_pos.x, sprite.tex_pos.y, sprite.tex_size.x, sprite.tex_size.y));
+    data->queue.push_back(sprite.color.to_vec4(0));
+}
+
+void SpriteRender::Finish()
+{
+    if (data->queue.empty())
+        return;
+
+    // Replacing the whole storage lets the driver avoid waiting for the previous draw call to finish.
+    data->buffer.SetData(data->queue.size(), data->queue.data(), Graphics::stream_draw);
+
+    data->shader.Bind();
+    // The shader has no attributes.
+    Graphics::VertexBuffers::BindDraw(0, nullptr);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, data->queue.size() / Data::texels_per_sprite);
+
+    data->queue.clear();
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <memory>
+
+#include "program/errors.h"
+#include "utils/mat.h"
+
+namespace Graphics
+{
+    struct ShaderConfig;
+    class TexUnit;
+    class Texture;
+}
+
+// Draws axis-aligned textured sprites using instancing.
+// Each sprite is a single compact record. The whole batch is uploaded to a buffer texture at once and drawn with one call, then the vertex shader expands each record into a quad.
+// Requires OpenGL 3.1 or newer (for buffer textures and `gl_InstanceID`).
+// The result matches `Render::iquad(pos, region).center().color(color).mix(0)`, except that the color matrix isn't supported.
+// Note that this uses its own shader, so you must call `Finish()` before mixing it with other renderers, and rebind their shaders afterwards.
+class SpriteRender
+{
+    struct Data;
+    std::unique_ptr<Data> data;
+
+  public:
+    // The instance record.
+    struct Sprite
+    {
+        fvec2 pos; // The center.
+        fvec2 size;
+        fvec2 tex_pos, tex_size;
+        fvec3 color; // Replaces the texture color, the alpha is taken from the texture.
+    };
+
+    SpriteRender();
+    SpriteRender(const Graphics::ShaderConfig &config);
+
+    SpriteRender(SpriteRender &&) noexcept;
+    SpriteRender &operator=(SpriteRender &&) noexcept;
+    ~SpriteRender();
+
+    explicit operator bool() const;
+
+    void SetTextureUnit(const Graphics::TexUnit &unit);
+    void SetTextureUnit(Graphics::TexUnit &&) = delete;
+
+    void SetTextureSize(ivec2 size);
+
+    void SetTexture(const Graphics::Texture &tex);
+    void SetTexture(Graphics::Texture &&) = delete;
+
+    void SetMatrix(const fmat4 &m);
+
+    // Draws automatically when the internal queue is full.
+    void Add(const Sprite &sprite);
+
+    // Draws the queued sprites. Binds the shader.
+    void Finish();
+};
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <array>
+#include <bitset>
+#include <cstdint>
 #include <functional>
 #include <unordered_map>
 #include <utility>
@@ -19,6 +22,10 @@ namespace Graphics
             int advance = 0;
         };
 
+        // Glyphs for the characters below this are stored in a flat array rather than in a hash map.
+        // This covers ASCII and Latin-1, which is what most texts consist of.
+        static constexpr uint32_t flat_glyph_count = 256;
+
       private:
         int ascent = 0;
         int descent = 0;
@@ -27,10 +34,26 @@ namespace Graphics
         using kerning_func_t = std::function<int(uint32_t, uint32_t)>;
         kerning_func_t kerning_func = 0;
 
-        // Some code might rely on references not being invalidated on insertion. Keep that in mind if you decide to change the container.
-        std::unordered_map<uint32_t, Glyph> glyphs;
+        // Precomputed kerning, see `SetKerningPair()`. Only non-zero values are stored.
+        // If this is used, `kerning_func` is only called for the pairs outside of the table, see `SetKerningTableCharLimit()`.
+        bool has_kerning_table = false;
+        std::unordered_map<uint64_t, int> kerning_table;
+        uint32_t kerning_table_char_limit = -1;
+
+        // Some code might rely on references not being invalidated on insertion. Keep that in mind if you decide to change the containers.
+        std::array<Glyph, flat_glyph_count> flat_glyphs;
+        std::bitset<flat_glyph_count> flat_glyph_exists;
+        std::unordered_map<uint32_t, Glyph> glyphs; // Only the characters starting from `flat_glyph_count`.
         Glyph default_glyph;
 
+        // Incremented when glyphs are added or removed, see `Generation()`.
+        uint64_t generation = 0;
+
+        [[nodiscard]] static uint64_t KerningPairKey(uint32_t a, uint32_t b)
+        {
+            return uint64_t(a) << 32 | b;
+        }
+
       public:
         void SetAscent(int new_ascent)
         {
@@ -49,6 +72,38 @@ namespace Graphics
             kerning_func = std::move(new_kerning_func);
         }
 
+        // Switches the font to the precomputed kerning table, and removes all pairs from it.
+        // After this, `Kerning()` returns 0 for the pairs not added with `SetKerningPair()`, and the kerning function is ignored,
+        //   unless `SetKerningTableCharLimit()` is used.
+        void ResetKerningTable()
+        {
+            has_kerning_table = true;
+            kerning_table.clear();
+            kerning_table_char_limit = -1;
+        }
+        // Switches the font back to the kerning function, and removes the kerning table.
+        void RemoveKerningTable()
+        {
+            has_kerning_table = false;
+            kerning_table = {};
+            kerning_table_char_limit = -1;
+        }
+        // Makes the kerning table cover only the pairs where both characters are below `limit`.
+        // The other pairs are passed to the kerning function, if any.
+        void SetKerningTableCharLimit(uint32_t limit)
+        {
+            kerning_table_char_limit = limit;
+        }
+        // Adds a pair to the kerning table. Switches to the table if it's not used yet.
+        void SetKerningPair(uint32_t a, uint32_t b, int value)
+        {
+            has_kerning_table = true;
+            if (value)
+                kerning_table.insert_or_assign(KerningPairKey(a, b), value);
+            else
+                kerning_table.erase(KerningPairKey(a, b));
+        }
+
         int Ascent() const
         {
             return ascent;
@@ -76,16 +131,37 @@ namespace Graphics
         }
         bool HasKerning() const
         {
-            return bool(kerning_func);
+            if (!has_kerning_table)
+                return bool(kerning_func);
+            return !kerning_table.empty() || (kerning_table_char_limit != uint32_t(-1) && kerning_func);
+        }
+        bool HasKerningTable() const
+        {
+            return has_kerning_table;
         }
         int Kerning(uint32_t a, uint32_t b) const
         {
+            if (has_kerning_table && a < kerning_table_char_limit && b < kerning_table_char_limit)
+            {
+                if (kerning_table.empty())
+                    return 0;
+                auto it = kerning_table.find(KerningPairKey(a, b));
+                return it != kerning_table.end() ? it->second : 0;
+            }
+
             if (kerning_func)
                 return kerning_func(a, b);
             else
                 return 0;
         }
 
+        // Changes when glyphs are added or removed. The texts laid out before that can refer to missing glyphs, or use the default glyph where they shouldn't.
+        // `Render::PreparedText` uses this to know when to redo the layout.
+        uint64_t Generation() const
+        {
+            return generation;
+        }
+
         Glyph &DefaultGlyph()
         {
             return default_glyph;
@@ -98,6 +174,9 @@ namespace Graphics
         // Note that returned references remain valid even after insertions.
         const Glyph &Get(uint32_t ch) const
         {
+            if (ch < flat_glyph_count)
+                return flat_glyph_exists[ch] ? flat_glyphs[ch] : default_glyph;
+
             if (auto it = glyphs.find(ch); it != glyphs.end())
                 return it->second;
             else
@@ -105,7 +184,37 @@ namespace Graphics
         }
         Glyph &Insert(uint32_t ch) // If the glyph already exists, returns a reference to it instead of creating a new one.
         {
-            return glyphs.insert({ch, {}}).first->second;
+            if (ch < flat_glyph_count)
+            {
+                if (!flat_glyph_exists[ch])
+                    generation++;
+                flat_glyph_exists[ch] = true;
+                return flat_glyphs[ch];
+            }
+
+            auto [it, inserted] = glyphs.try_emplace(ch);
+            if (inserted)
+                generation++;
+            return it->second;
+        }
+        // Returns false if there was no such glyph. Invalidates references to the removed glyph.
+        bool Remove(uint32_t ch)
+        {
+            bool existed = false;
+            if (ch < flat_glyph_count)
+            {
+                existed = flat_glyph_exists[ch];
+                flat_glyph_exists[ch] = false;
+                flat_glyphs[ch] = {};
+            }
+            else
+            {
+                existed = glyphs.erase(ch) > 0;
+            }
+
+            if (existed)
+                generation++;
+            return existed;
         }
     };
 }
@@ -16,6 +16,7 @@
 #include "strings/format.h"
 #include "utils/mat.h"
 #include "utils/packing.h"
+#include "utils/thread_pool.h"
 #include "utils/unicode_ranges.h"
 #include "utils/unicode.h"
 
@@ -34,6 +35,8 @@ namespace Graphics
         {
             FT_Face ft_font = 0;
             Stream::ReadOnlyData file;
+            ivec2 size = ivec2(0); // Those are saved for `Clone()`.
+            int index = 0;
         };
 
         Data data;
@@ -58,6 +61,8 @@ namespace Graphics
             }
 
             data.file = std::move(file); // Memory files are ref-counted, but moving won't hurt.
+            data.size = size;
+            data.index = index;
 
             FT_Open_Args args{};
             args.flags = FT_OPEN_MEMORY;
@@ -121,6 +126,14 @@ namespace Graphics
             }
         }
 
+        // Opens another FreeType face for the same file data and size. The file contents are shared, not copied.
+        // A single face can't be used by several threads at the same time, but different faces can, so use this to give each thread its own face.
+        // This function itself is not thread-safe, since it modifies the shared FreeType context.
+        [[nodiscard]] FontFile Clone() const
+        {
+            return FontFile(data.file, data.size, data.index);
+        }
+
         static void UnloadLibrary() // Use this to unload freetype. This function throws if you have opened fonts.
         {
             if (open_font_count > 0)
@@ -164,11 +177,22 @@ namespace Graphics
         {
             if (!HasKerning())
                 return 0;
+            return KerningByIndex(GlyphIndex(a), GlyphIndex(b));
+        }
+        // Same as `Kerning()`, but takes the glyph indices returned by `GlyphIndex()`. Doesn't check `HasKerning()`.
+        // Use this when querying many pairs, to look up each character only once.
+        int KerningByIndex(uint32_t a, uint32_t b) const
+        {
             FT_Vector vec;
-            if (FT_Get_Kerning(data.ft_font, FT_Get_Char_Index(data.ft_font, a), FT_Get_Char_Index(data.ft_font, b), FT_KERNING_DEFAULT, &vec))
+            if (FT_Get_Kerning(data.ft_font, a, b, FT_KERNING_DEFAULT, &vec))
                 return 0;
             return (vec.x + (1 << 5)) >> 6; // The kerning is measured in 26.6 fixed point pixels, so we round it.
         }
+        // Returns the index of the glyph for a character in the font, or 0 if there's no such glyph.
+        uint32_t GlyphIndex(uint32_t ch) const
+        {
+            return FT_Get_Char_Index(data.ft_font, ch);
+        }
 
         // Constructs a functor to return kerning. Freetype font handle is copied into the functior, you should keep corresponding object alive as long as you need it.
         // If the font doesn't support kerning, null functor is returned.
@@ -324,7 +348,11 @@ namespace Graphics
             : target(&target), source(&source), glyphs(&glyphs), render_flags(render_flags), flags(flags) {}
     };
 
-    inline void MakeFontAtlas(Image &image, ivec2 pos, ivec2 size, const std::vector<FontAtlasEntry> &entries, bool add_gaps = 1) // Throws on failure.
+    // See `MakeFontAtlas()`.
+    inline constexpr std::size_t max_precomputed_kerning_glyphs = 1024;
+
+    // If `thread_pool` is specified, the glyphs are rasterized in parallel, with a separate FreeType face per job. The result is the same as without it.
+    inline void MakeFontAtlas(Image &image, ivec2 pos, ivec2 size, const std::vector<FontAtlasEntry> &entries, bool add_gaps = 1, ThreadPool *thread_pool = nullptr) // Throws on failure.
     {
         if (!image.RectInBounds(pos, size))
             Program::Error("Invalid target rectangle for a font atlas.");
@@ -332,37 +360,31 @@ namespace Graphics
         struct Glyph
         {
             Font::Glyph *target = 0;
-            Image image;
+            std::size_t entry_index = 0;
+            uint32_t ch = 0;
+            FontFile::GlyphData data;
         };
 
         std::vector<Glyph> glyphs;
         std::vector<Packing::Rect> rects;
 
-        for (const FontAtlasEntry &entry : entries)
+        for (std::size_t entry_index = 0; entry_index < entries.size(); entry_index++)
         {
+            const FontAtlasEntry &entry = entries[entry_index];
+
             // Save font metrics.
             entry.target->SetAscent(entry.source->Ascent());
             entry.target->SetDescent(entry.source->Descent());
             entry.target->SetLineSkip(entry.flags & entry.no_line_gap ? entry.source->Height() : entry.source->LineSkip());
-            entry.target->SetKerningFunc(entry.source->KerningFunc());
+            entry.target->SetKerningFunc(nullptr);
 
             auto AddGlyph = [&](uint32_t ch)
             {
                 if (!entry.source->HasGlyph(ch))
                     return;
 
-                // Copy glyph to the font.
-                FontFile::GlyphData glyph_data = entry.source->GetGlyph(ch, entry.render_flags);
                 Font::Glyph &font_glyph = (ch != Unicode::default_char ? entry.target->Insert(ch) : entry.target->DefaultGlyph());
-                font_glyph.size = glyph_data.image.Size();
-                font_glyph.offset = glyph_data.offset;
-                font_glyph.advance = glyph_data.advance;
-
-                // Save it into the glyph vector.
-                glyphs.push_back({&font_glyph, std::move(glyph_data.image)}); // We rely on the fact that Graphics::Font doesn't invalidate references on insertions.
-
-                // Save it into the rect vector.
-                rects.emplace_back(font_glyph.size);
+                glyphs.push_back({&font_glyph, entry_index, ch, {}}); // We rely on the fact that Graphics::Font doesn't invalidate references on insertions.
             };
 
             // Save the default glyph.
@@ -372,6 +394,88 @@ namespace Graphics
             // Save the rest of the glyphs.
             for (uint32_t ch : *entry.glyphs)
                 AddGlyph(ch);
+
+            // Precompute kerning for all pairs of the glyphs, so that the text layout doesn't need to query the font file.
+            // This costs a FreeType call per pair (about 9000 for Basic Latin), so above `max_precomputed_kerning_glyphs` glyphs
+            //   only the pairs of the characters below `Font::flat_glyph_count` are precomputed, and the rest query the font file when needed.
+            //   In that case the font file must outlive the font.
+            entry.target->ResetKerningTable();
+            if (entry.source->HasKerning())
+            {
+                struct KernedChar
+                {
+                    uint32_t ch = 0;
+                    uint32_t index = 0; // See `FontFile::GlyphIndex()`.
+                };
+                std::vector<KernedChar> kerned_chars;
+                for (uint32_t ch : *entry.glyphs)
+                {
+                    // Zero means there's no glyph, which has no kerning.
+                    if (uint32_t index = entry.source->GlyphIndex(ch))
+                        kerned_chars.push_back({ch, index});
+                }
+
+                if (kerned_chars.size() > max_precomputed_kerning_glyphs)
+                {
+                    std::erase_if(kerned_chars, [](const KernedChar &kerned_char){return kerned_char.ch >= Font::flat_glyph_count;});
+                    entry.target->SetKerningTableCharLimit(Font::flat_glyph_count);
+                    entry.target->SetKerningFunc(entry.source->KerningFunc());
+                }
+
+                for (const KernedChar &a : kerned_chars)
+                {
+                    for (const KernedChar &b : kerned_chars)
+                    {
+                        // Only the non-zero values are stored, so the glyphs without kerning don't take any space.
+                        if (int value = entry.source->KerningByIndex(a.index, b.index))
+                            entry.target->SetKerningPair(a.ch, b.ch, value);
+                    }
+                }
+            }
+        }
+
+        // Rasterize the glyphs.
+        // This doesn't touch the target fonts, since several entries can write to the same glyph.
+        auto RenderGlyph = [&](Glyph &glyph, const FontFile &source)
+        {
+            glyph.data = source.GetGlyph(glyph.ch, entries[glyph.entry_index].render_flags);
+        };
+
+        if (!thread_pool || thread_pool->ThreadCount() == 1 || glyphs.size() < 2)
+        {
+            for (Glyph &glyph : glyphs)
+                RenderGlyph(glyph, *entries[glyph.entry_index].source);
+        }
+        else
+        {
+            // Each job gets a contiguous range of glyphs and its own faces. The faces are opened here, since that isn't thread-safe.
+            int num_jobs = std::min(std::size_t(thread_pool->ThreadCount()), glyphs.size());
+            std::vector<std::vector<FontFile>> job_faces(num_jobs);
+            for (std::vector<FontFile> &faces : job_faces)
+            {
+                faces.reserve(entries.size());
+                for (const FontAtlasEntry &entry : entries)
+                    faces.push_back(entry.source->Clone());
+            }
+
+            thread_pool->ForEachIndex(num_jobs, [&](int job)
+            {
+                std::size_t begin = glyphs.size() * job / num_jobs;
+                std::size_t end = glyphs.size() * (job + 1) / num_jobs;
+                for (std::size_t i = begin; i < end; i++)
+                    RenderGlyph(glyphs[i], job_faces[job][glyphs[i].entry_index]);
+            });
+        }
+
+        // Copy the glyphs to the fonts.
+        rects.reserve(glyphs.size());
+        for (const Glyph &glyph : glyphs)
+        {
+            glyph.target->size = glyph.data.image.Size();
+            glyph.target->offset = glyph.data.offset;
+            glyph.target->advance = glyph.data.advance;
+
+            rects.emplace_back(glyph.target->size);
         }
 
         // Pack rectangles.
@@ -388,7 +492,7 @@ namespace Graphics
 
             glyphs[i].target->texture_pos = glyph_pos;
 
-            image.UnsafeDrawImage(glyphs[i].image, glyph_pos);
+            image.UnsafeDrawImage(glyphs[i].data.image, glyph_pos);
         }
     }
 }
@@ -0,0 +1,280 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "graphics/font.h"
+#include "graphics/font_file.h"
+#include "graphics/image.h"
+#include "graphics/texture.h"
+#include "program/errors.h"
+#include "utils/mat.h"
+#include "utils/unicode.h"
+
+namespace Graphics
+{
+    // Rasterizes the glyphs on demand, the first time they are used, instead of prerendering a fixed set with `MakeFontAtlas()`.
+    // This is meant for fonts with huge character sets, such as the CJK ones.
+    // The glyphs are packed into pages, which are horizontal strips of the target image region, allocated as needed.
+    // When the region is full, the least recently used page is cleared, and its glyphs are removed from the font.
+    // Only the modified parts of the image need to be uploaded to the texture, see `UploadDirtyRects()`.
+    //
+    // The kerning is looked up in the font file the first time each pair is laid out, and then cached in the font's kerning function.
+    // Because of that, `source` must outlive `target` (or until `target` gets a different kerning function).
+    // Since the glyphs can be evicted, the texture coordinates stored in `Graphics::Text` can become outdated.
+    // Either lay out such texts each frame, or redo the layout when `Font::Generation()` changes. `Render::PreparedText` does the latter when built from a font.
+    // In both cases, request the strings each frame, so that their glyphs stay in the cache.
+    // Example usage:
+    //     cache.NextFrame();
+    //     cache.Request(str);
+    //     r.itext(pos, Graphics::Text(font, str));
+    //     ...
+    //     cache.UploadDirtyRects(texture); // Before drawing.
+    class GlyphCache
+    {
+      public:
+        struct Stats
+        {
+            std::size_t rasterized = 0; // Glyphs rasterized so far.
+            std::size_t evicted_pages = 0;
+        };
+
+      private:
+        struct Page
+        {
+            int y = 0; // Relative to the region.
+            int cursor_x = 0; // Where the next glyph goes, relative to the region.
+            int dirty_begin_x = 0, dirty_end_x = 0; // The part of the page that needs to be uploaded. Empty if equal.
+            std::uint64_t last_used_frame = 0;
+            std::vector<uint32_t> chars; // The glyphs stored in this page.
+        };
+
+        // Marks the characters the font has no glyphs for, so we don't check them again. They use the default glyph.
+        static constexpr int no_glyph = -1;
+
+        Font *target = nullptr;
+        const FontFile *source = nullptr;
+        FontFile::RenderFlags render_flags = FontFile::none;
+
+        Image *image = nullptr;
+        ivec2 region_pos = ivec2(0);
+        ivec2 region_size = ivec2(0);
+        int page_height = 0;
+        int gap = 0; // Between the glyphs, and between the pages.
+
+        std::vector<Page> pages; // The first page is never evicted, it contains the default glyph.
+        std::unordered_map<uint32_t, int> glyph_pages; // Maps characters to page indices, or to `no_glyph`.
+
+        std::uint64_t frame = 1;
+        bool full_upload_needed = true;
+        std::vector<u8vec4> upload_buffer;
+        Stats stats;
+
+        // Returns a page that has enough space for a glyph of this width, allocating or evicting one if necessary.
+        int FindPage(int width)
+        {
+            for (int i = 0; i < int(pages.size()); i++)
+            {
+                if (pages[i].cursor_x + width <= region_size.x)
+                    return i;
+            }
+
+            // Allocate a new page.
+            int next_y = pages.empty() ? 0 : pages.back().y + page_height + gap;
+            if (next_y + page_height <= region_size.y)
+            {
+                pages.emplace_back().y = next_y;
+                return pages.size() - 1;
+            }
+
+            // Evict the least recently used page. The pages used in the current frame are not evicted, because they may be drawn after this.
+            int lru = -1;
+            for (int i = 1; i < int(pages.size()); i++)
+            {
+                if (pages[i].last_used_frame != frame && (lru == -1 || pages[i].last_used_frame < pages[lru].last_used_frame))
+                    lru = i;
+            }
+            if (lru == -1)
+                Program::Error("The glyph cache is too small to fit all glyphs used in a single frame.");
+
+            EvictPage(lru);
+            return lru;
+        }
+
+        void EvictPage(int index)
+        {
+            Page &page = pages[index];
+            for (uint32_t ch : page.chars)
+            {
+                target->Remove(ch);
+                glyph_pages.erase(ch);
+            }
+            page.chars.clear();
+            page.cursor_x = 0;
+
+            // Clear the pixels, otherwise the leftovers could bleed into the new glyphs with linear interpolation.
+            image->UnsafeFill(region_pos + ivec2(0, page.y), ivec2(region_size.x, page_height), u8vec4(0));
+            page.dirty_begin_x = 0;
+            page.dirty_end_x = region_size.x;
+
+            stats.evicted_pages++;
+        }
+
+        void AddGlyph(uint32_t ch)
+        {
+            FontFile::GlyphData glyph_data = source->GetGlyph(ch, render_flags);
+            ivec2 size = glyph_data.image.Size();
+            if (size.x > region_size.x || size.y > page_height)
+                Program::Error("Glyph ", ch, " is too large for the glyph cache page: ", size.x, 'x', size.y, ".");
+
+            int page_index = FindPage(size.x);
+            Page &page = pages[page_index];
+
+            ivec2 pos = region_pos + ivec2(page.cursor_x, page.y);
+            image->UnsafeDrawImage(glyph_data.image, pos);
+
+            if (size.x > 0)
+            {
+                if (page.dirty_begin_x == page.dirty_end_x)
+                    page.dirty_begin_x = page.cursor_x;
+                else
+                    clamp_var_max(page.dirty_begin_x, page.cursor_x);
+                clamp_var_min(page.dirty_end_x, page.cursor_x + size.x);
+            }
+            page.cursor_x += size.x + gap;
+            page.last_used_frame = frame;
+
+            Font::Glyph &font_glyph = (ch != Unicode::default_char ? target->Insert(ch) : target->DefaultGlyph());
+            font_glyph.texture_pos = pos;
+            font_glyph.size = size;
+            font_glyph.offset = glyph_data.offset;
+            font_glyph.advance = glyph_data.advance;
+
+            page.chars.push_back(ch);
+            glyph_pages.insert_or_assign(ch, page_index);
+            stats.rasterized++;
+        }
+
+        void UploadRect(Texture &texture, ivec2 pos, ivec2 size)
+        {
+            if (size.x <= 0 || size.y <= 0)
+                return;
+
+            upload_buffer.resize(size.prod());
+            for (int y = 0; y < size.y; y++)
+            {
+                const u8vec4 *row = &image->UnsafeAt(pos + ivec2(0, y));
+                std::copy(row, row + size.x, upload_buffer.data() + size.x * y);
+            }
+            texture.SetDataPart(pos, size, reinterpret_cast<const uint8_t *>(upload_buffer.data()));
+        }
+
+      public:
+        GlyphCache() {}
+
+        // The glyphs are drawn to `image`, in the rectangle specified by `pos` and `size`. The image must outlive the cache, and so must `target` and `source`.
+        // `page_height` must be large enough for the tallest glyph, normally it's slightly larger than `source.Height()`.
+        GlyphCache(Font &target, const FontFile &source, Image &image, ivec2 pos, ivec2 size, int page_height, FontFile::RenderFlags render_flags = FontFile::none, bool add_gaps = 1)
+            : target(&target), source(&source), render_flags(render_flags), image(&image), region_pos(pos), region_size(size), page_height(page_height), gap(add_gaps)
+        {
+            if (!image.RectInBounds(pos, size))
+                Program::Error("Invalid target rectangle for a glyph cache.");
+            if (page_height <= 0 || page_height > size.y)
+                Program::Error("Invalid glyph cache page height: ", page_height, ".");
+
+            // Save font metrics.
+            target.SetAscent(source.Ascent());
+            target.SetDescent(source.Descent());
+            target.SetLineSkip(source.LineSkip());
+
+            // The kerning is looked up lazily, since most pairs never occur in the texts. The pairs remain cached after the eviction, since the kerning doesn't change.
+            target.RemoveKerningTable();
+            if (source.HasKerning())
+            {
+                target.SetKerningFunc([source = &source, pairs = std::make_shared<std::unordered_map<std::uint64_t, int>>()](uint32_t a, uint32_t b)
+                {
+                    auto [it, inserted] = pairs->try_emplace(std::uint64_t(a) << 32 | b);
+                    if (inserted)
+                        it->second = source->Kerning(a, b);
+                    return it->second;
+                });
+            }
+            else
+            {
+                target.SetKerningFunc(nullptr);
+            }
+
+            image.UnsafeFill(pos, size, u8vec4(0));
+
+            // This goes to the first page, which is never evicted.
+            AddGlyph(Unicode::default_char);
+        }
+
+        GlyphCache(const GlyphCache &) = delete;
+        GlyphCache &operator=(const GlyphCache &) = delete;
+
+        // Call this once per frame. The glyphs used during the current frame are never evicted.
+        void NextFrame()
+        {
+            frame++;
+        }
+
+        // Makes sure the glyph is rasterized, and marks it as used in this frame.
+        // Call this before laying out the text with the target font.
+        void Request(uint32_t ch)
+        {
+            if (ch == '\n')
+                return;
+
+            if (auto it = glyph_pages.find(ch); it != glyph_pages.end())
+            {
+                if (it->second != no_glyph)
+                    pages[it->second].last_used_frame = frame;
+                return;
+            }
+
+            if (!source->HasGlyph(ch))
+            {
+                glyph_pages.emplace(ch, no_glyph);
+                return;
+            }
+
+            AddGlyph(ch);
+        }
+        void Request(std::string_view str)
+        {
+            for (uint32_t ch : Unicode::Iterator(str.data(), str.data() + str.size()))
+                Request(ch);
+        }
+
+        // Uploads the modified parts of the region to the texture, which must have the same size as the image.
+        void UploadDirtyRects(Texture &texture)
+        {
+            if (full_upload_needed)
+            {
+                UploadRect(texture, region_pos, region_size);
+                full_upload_needed = false;
+                for (Page &page : pages)
+                    page.dirty_begin_x = page.dirty_end_x = 0;
+                return;
+            }
+
+            for (Page &page : pages)
+            {
+                if (page.dirty_begin_x == page.dirty_end_x)
+                    continue;
+                UploadRect(texture, region_pos + ivec2(page.dirty_begin_x, page.y), ivec2(page.dirty_end_x - page.dirty_begin_x, page_height));
+                page.dirty_begin_x = page.dirty_end_x = 0;
+            }
+        }
+
+        [[nodiscard]] const Stats &GetStats() const
+        {
+            return stats;
+        }
+    };
+}
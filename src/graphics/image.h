@@ -39,7 +39,7 @@ namespace Graphics
         }
         Image(Stream::ReadOnlyData file, FlipMode flip_mode = no_flip) // Throws on failure.
         {
-            stbi_set_flip_vertically_on_load(flip_mode == flip_y);
+            stbi_set_flip_vertically_on_load_thread(flip_mode == flip_y);
             ivec2 img_size;
             uint8_t *bytes = stbi_load_from_memory(file.data(), file.size(), &img_size.x, &img_size.y, 0, 4);
             if (!bytes)
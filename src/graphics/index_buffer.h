@@ -160,6 +160,17 @@ namespace Graphics
             Bind();
             glDrawElements(m, count, IndexTypeEnum(), (void *)(uintptr_t)(offset * sizeof(T)));
         }
+        #ifdef glDrawElementsBaseVertex
+        // `base_vertex` is added to each index.
+        void DrawFromBoundBuffer(DrawMode m, int offset, int count, int base_vertex) const // Binds the buffer.
+        {
+            ASSERT(*this, "Attempt to use a null index buffer.");
+            if (!*this)
+                return;
+            Bind();
+            glDrawElementsBaseVertex(m, count, IndexTypeEnum(), (void *)(uintptr_t)(offset * sizeof(T)), base_vertex);
+        }
+        #endif
         void DrawFromBoundBuffer(DrawMode m, int count) const // Binds the buffer.
         {
             DrawFromBoundBuffer(m, 0, count);
@@ -176,6 +187,15 @@ namespace Graphics
             DrawFromBoundBuffer(m, offset, count);
         }
 
+        #ifdef glDrawElementsBaseVertex
+        template <typename V>
+        void Draw(const VertexBuffer<V> &buffer, DrawMode m, int offset, int count, int base_vertex) const // Binds this buffer (and well as the passed vertex buffer).
+        {
+            buffer.BindDraw();
+            DrawFromBoundBuffer(m, offset, count, base_vertex);
+        }
+        #endif
+
         template <typename V>
         void Draw(const VertexBuffer<V> &buffer, DrawMode m, int count) const // Binds this buffer (and well as the passed vertex buffer).
         {
@@ -2,23 +2,46 @@
 
 #include <algorithm>
 #include <array>
+#include <cstdint>
+#include <limits>
 #include <memory>
 #include <type_traits>
 #include <vector>
 
+#include "graphics/index_buffer.h"
 #include "graphics/vertex_buffer.h"
+#include "program/errors.h"
 
 namespace Graphics
 {
+    // `N` is the number of vertices per primitive: 1 (points), 2 (lines), 3 (triangles), or 4 (quads).
+    // In the quad mode, each quad is stored as 4 vertices, and is drawn as two triangles using a pre-built index buffer.
+    // Triangles can be added to a quad queue too, they're stored as degenerate quads.
+    // The vertex buffer is used as a ring: each flush appends to it, so it never overwrites the data that could still be used by the previous draw calls.
+    // When the ring is full, the buffer is orphaned, and the writing starts from the beginning of the new storage.
     template <typename T, int N>
     class SimpleRenderQueue
     {
         static_assert(Graphics::VertexBuffer<T>::is_reflected, "The type must be reflected.");
-        static_assert(N >= 1 && N <= 3, "N must be 1 (points), 2 (lines), or 3 (triangles).");
+        static_assert(N >= 1 && N <= 4, "N must be 1 (points), 2 (lines), 3 (triangles), or 4 (quads).");
 
+        using index_t = std::uint16_t;
+
+      public:
+        struct Stats
+        {
+            std::size_t flushes = 0; // Only the ones that actually draw something.
+            std::size_t bytes_uploaded = 0;
+            std::size_t orphans = 0;
+        };
+
+      private:
         std::size_t pos = 0, size = 0; // These are measured in primitives, not vertices.
+        std::size_t ring_pos = 0, ring_size = 0; // These are measured in vertices.
+        Stats stats;
         std::unique_ptr<T[]> storage;
         Graphics::VertexBuffer<T> buffer;
+        Graphics::IndexBuffer<index_t> index_buffer; // Only used in the quad mode.
 
         template <typename ...P>
         void AddLow(const P &... p)
@@ -32,11 +55,37 @@ namespace Graphics
             pos++;
         }
 
+        [[nodiscard]] static Graphics::IndexBuffer<index_t> MakeQuadIndexBuffer(std::size_t quad_count)
+        {
+            if (quad_count * 4 > std::size_t(std::numeric_limits<index_t>::max()) + 1)
+                Program::Error("The render queue is too large for 16-bit indices.");
+
+            std::vector<index_t> indices(quad_count * 6);
+            for (std::size_t i = 0; i < quad_count; i++)
+            {
+                // Same vertex order as the triangle mode uses for quads.
+                for (int j = 0; j < 6; j++)
+                    indices[i * 6 + j] = index_t(i * 4 + std::array{0, 1, 3, 3, 1, 2}[j]);
+            }
+            return Graphics::IndexBuffer<index_t>(indices.size(), indices.data());
+        }
+
       public:
         SimpleRenderQueue() {}
 
         // The size is measured in primitives, not vertices.
-        SimpleRenderQueue(std::size_t size) : size(size), storage(std::make_unique<T[]>(size * N)), buffer(size * N, 0, Graphics::stream_draw) {}
+        // The vertex buffer holds `ring_segments` times that, see the comment on the class.
+        SimpleRenderQueue(std::size_t size, int ring_segments = 4)
+            : size(size), ring_size(size * N * ring_segments), storage(std::make_unique<T[]>(size * N)), buffer(ring_size, 0, Graphics::stream_draw)
+        {
+            #ifndef glDrawElementsBaseVertex
+            if constexpr (N == 4)
+                ring_size = size * N; // Can't draw indexed quads from an offset, so orphan on every flush.
+            #endif
+
+            if constexpr (N == 4)
+                index_buffer = MakeQuadIndexBuffer(size);
+        }
 
         [[nodiscard]] explicit operator bool()
         {
@@ -61,12 +110,45 @@ namespace Graphics
             return size;
         }
 
+        // The counters accumulate until `ResetStats()`.
+        [[nodiscard]] const Stats &GetStats() const
+        {
+            return stats;
+        }
+        void ResetStats()
+        {
+            stats = {};
+        }
+
         void Flush()
         {
             if (pos <= 0)
                 return;
-            buffer.SetDataPart(0, pos * N, storage.get());
-            buffer.Draw(std::array{points, lines, triangles}[N-1], pos * N);
+            std::size_t vertex_count = pos * N;
+            if (ring_pos + vertex_count > ring_size)
+            {
+                buffer.Orphan();
+                ring_pos = 0;
+                stats.orphans++;
+            }
+
+            buffer.SetDataPart(ring_pos, vertex_count, storage.get());
+            if constexpr (N == 4)
+            {
+                #ifdef glDrawElementsBaseVertex
+                index_buffer.Draw(buffer, triangles, 0, pos * 6, ring_pos);
+                #else
+                index_buffer.Draw(buffer, triangles, pos * 6);
+                #endif
+            }
+            else
+            {
+                buffer.Draw(std::array{points, lines, triangles}[N-1], ring_pos, vertex_count);
+            }
+
+            ring_pos += vertex_count;
+            stats.flushes++;
+            stats.bytes_uploaded += vertex_count * sizeof(T);
             pos = 0;
         }
 
@@ -87,5 +169,14 @@ namespace Graphics
             AddLow(a, b, d);
             AddLow(d, b, c);
         }
+        void Add(const T &a, const T &b, const T &c) requires (N == 4/*sic*/)
+        {
+            // A degenerate quad. The second triangle has zero area.
+            AddLow(a, b, c, c);
+        }
+        void Add(const T &a, const T &b, const T &c, const T &d) requires (N == 4)
+        {
+            AddLow(a, b, c, d);
+        }
     };
 }
@@ -1,93 +1,317 @@
 #include "texture_atlas.h"
 
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
 #include <memory>
 
 #include "reflection/full.h"
+#include "stream/input.h"
 #include "stream/readonly_data.h"
 #include "stream/save_to_file.h"
+#include "utils/archive.h"
+#include "utils/hash.h"
+#include "utils/memory_access.h"
 #include "utils/packing.h"
+#include "utils/thread_pool.h"
 
 namespace Graphics
 {
-    TextureAtlas::TextureAtlas(ivec2 target_size, const std::string &source_dir, const std::string &out_image_file, const std::string &out_desc_file, const std::map<std::string, ivec2> &artifical_regions, bool add_gaps)
-        : source_dir(source_dir)
+    // Returns the amount of seconds since the last call, and resets the timer.
+    static double LapSeconds(std::chrono::steady_clock::time_point &time)
     {
-        constexpr int max_nesting_level = 32;
+        auto new_time = std::chrono::steady_clock::now();
+        double ret = std::chrono::duration<double>(new_time - time).count();
+        time = new_time;
+        return ret;
+    }
 
-        // Decide if regenrating the atlas should be allowed.
-        bool allow_regeneration = !source_dir.empty();
+    // The binary cache format. All numbers are little-endian.
+    // Header:
+    //     char[4] magic, u32 version, u32 flags (see below), u64[2] image file stamp, u64[2] description file stamp (see `SourceStamp()`),
+    //     i32[2] image size, i32[2] target size, u32 add gaps, u32 image count.
+    // Then for each image, sorted by name:
+    //     i32[2] pos, i32[2] size, u64 hash, u32 name length, char[] name (not null-terminated).
+    // Then the pixels, either raw RGBA, or compressed with `Archive::Compress()`.
+    static constexpr char binary_cache_magic[4] = {'A','T','L','S'};
+    static constexpr std::uint32_t binary_cache_version = 2;
+    static constexpr std::uint32_t binary_cache_flag_compressed = 1;
+    // Anything larger than this is treated as a corrupted cache. This also keeps the pixel byte count far from overflowing.
+    static constexpr int binary_cache_max_image_size = 1 << 15;
 
-        Filesystem::TreeNode source_tree;
+    // Identifies the current version of a file the binary cache was made from, so that the cache is rejected after the file changes.
+    // Returns the size and the modification time, or zeros if the file can't be accessed.
+    static std::array<std::uint64_t, 2> SourceStamp(const std::string &file_name)
+    {
+        bool ok = false;
+        Filesystem::ObjInfo info = Filesystem::GetObjectInfo(file_name, &ok);
+        if (!ok)
+            return {};
+        return {info.size, std::uint64_t(info.time_modified)};
+    }
+
+    void TextureAtlas::SaveBinaryCache(const std::string &file_name, bool compress, const std::string &image_file, const std::string &desc_file) const
+    {
+        std::vector<std::uint8_t> buffer;
 
-        // If regeneration is allowed, try getting the source directory tree and its modification time.
-        if (allow_regeneration)
+        auto WriteBytes = [&](const void *data, std::size_t size)
         {
-            // `GetObjectTree` will throw if the source directory doesn't exist.
-            source_tree = Filesystem::GetObjectTree(source_dir, max_nesting_level);
-            if (source_tree.info.category != Filesystem::directory)
-                Program::Error("Texture atlas source location `", source_dir, "` is not a directory.");
+            const std::uint8_t *bytes = static_cast<const std::uint8_t *>(data);
+            buffer.insert(buffer.end(), bytes, bytes + size);
+        };
+        auto Write = [&]<typename T>(T value)
+        {
+            std::size_t pos = buffer.size();
+            buffer.resize(pos + sizeof(T));
+            Memory::Write<T>(buffer.data() + pos, value, ByteOrder::little);
+        };
+
+        WriteBytes(binary_cache_magic, sizeof binary_cache_magic);
+        Write(binary_cache_version);
+        Write(std::uint32_t(compress ? binary_cache_flag_compressed : 0));
+        for (const std::string *source : {&image_file, &desc_file})
+        {
+            for (std::uint64_t value : SourceStamp(*source))
+                Write(value);
         }
+        Write(std::int32_t(image.Size().x));
+        Write(std::int32_t(image.Size().y));
+        Write(std::int32_t(desc.target_size.x));
+        Write(std::int32_t(desc.target_size.y));
+        Write(std::uint32_t(desc.add_gaps));
+        Write(std::uint32_t(desc.images.size()));
 
-        std::time_t image_time_modified = 0;
+        // `std::map` is already sorted.
+        for (const auto &[name, image_desc] : desc.images)
+        {
+            Write(std::int32_t(image_desc.pos.x));
+            Write(std::int32_t(image_desc.pos.y));
+            Write(std::int32_t(image_desc.size.x));
+            Write(std::int32_t(image_desc.size.y));
+            Write(std::uint64_t(image_desc.hash));
+            Write(std::uint32_t(name.size()));
+            WriteBytes(name.data(), name.size());
+        }
 
-        { // Get image file modification time. 0 if no file.
-            bool image_ok;
-            auto info = Filesystem::GetObjectInfo(out_image_file, &image_ok);
-            if (image_ok)
-            {
-                if (info.category != Filesystem::file)
-                    Program::Error("Texture atlas image `", out_image_file, "` is not a file.");
-                image_time_modified = info.time_modified;
-            }
+        const std::uint8_t *pixels_begin = image.Data(), *pixels_end = pixels_begin + image.Size().prod() * sizeof(u8vec4);
+        if (compress)
+        {
+            std::size_t pos = buffer.size();
+            buffer.resize(pos + Archive::MaxCompressedSize(pixels_begin, pixels_end));
+            std::uint8_t *end = Archive::Compress(pixels_begin, pixels_end, buffer.data() + pos, buffer.data() + buffer.size());
+            buffer.resize(end - buffer.data());
         }
+        else
+        {
+            WriteBytes(pixels_begin, pixels_end - pixels_begin);
+        }
+
+        Stream::SaveFile(file_name, buffer.data(), buffer.data() + buffer.size());
+    }
+
+    void TextureAtlas::LoadBinaryCache(const std::string &file_name, const std::string &image_file, const std::string &desc_file)
+    {
+        // Not using `ReadOnlyData`, to read the raw pixels directly into the image, without an intermediate copy of the whole file.
+        // The stream throws if the file is truncated.
+        Stream::Input file(file_name);
+
+        char magic[sizeof binary_cache_magic];
+        file.Read(magic, sizeof magic);
+        if (!std::equal(magic, magic + sizeof magic, binary_cache_magic))
+            Program::Error("`", file_name, "` is not a binary texture atlas cache.");
+        if (std::uint32_t version = file.ReadLittle<std::uint32_t>(); version != binary_cache_version)
+            Program::Error("Binary texture atlas cache `", file_name, "` has unsupported version ", version, ".");
+        std::uint32_t flags = file.ReadLittle<std::uint32_t>();
+
+        for (const std::string *source : {&image_file, &desc_file})
+        {
+            std::array<std::uint64_t, 2> stamp;
+            file.ReadLittle(stamp.data(), stamp.size());
+            if (stamp != SourceStamp(*source))
+                Program::Error("Binary texture atlas cache `", file_name, "` is out of date relative to `", *source, "`.");
+        }
+
+        ivec2 image_size;
+        image_size.x = file.ReadLittle<std::int32_t>();
+        image_size.y = file.ReadLittle<std::int32_t>();
+        if (image_size.min() <= 0 || image_size.max() > binary_cache_max_image_size)
+            Program::Error("Binary texture atlas cache `", file_name, "` has invalid image size.");
+
+        Desc new_desc;
+        new_desc.target_size.x = file.ReadLittle<std::int32_t>();
+        new_desc.target_size.y = file.ReadLittle<std::int32_t>();
+        new_desc.add_gaps = file.ReadLittle<std::uint32_t>();
+
+        std::uint32_t image_count = file.ReadLittle<std::uint32_t>();
+        for (std::uint32_t i = 0; i < image_count; i++)
+        {
+            ImageDesc image_desc;
+            image_desc.pos.x = file.ReadLittle<std::int32_t>();
+            image_desc.pos.y = file.ReadLittle<std::int32_t>();
+            image_desc.size.x = file.ReadLittle<std::int32_t>();
+            image_desc.size.y = file.ReadLittle<std::int32_t>();
+            image_desc.hash = file.ReadLittle<std::uint64_t>();
 
-        std::time_t desc_time_modified = 0;
+            std::uint32_t name_size = file.ReadLittle<std::uint32_t>();
+            if (name_size > file.RemainingBytes())
+                Program::Error("Binary texture atlas cache `", file_name, "` is truncated.");
+            std::string name(name_size, '\0');
+            file.Read(name.data(), name_size);
 
-        { // Get description file modification time. 0 if no file.
-            bool desc_ok;
-            auto info = Filesystem::GetObjectInfo(out_desc_file, &desc_ok);
-            if (desc_ok)
+            // Check each value before adding them, to avoid overflowing.
+            if (image_desc.pos.min() < 0 || image_desc.size.min() < 0 || image_desc.pos.max() > binary_cache_max_image_size || image_desc.size.max() > binary_cache_max_image_size
+                || ((image_desc.pos + image_desc.size) > image_size).any())
             {
-                if (info.category != Filesystem::file)
-                    Program::Error("Texture atlas description `", out_desc_file, "` is not a file.");
-                desc_time_modified = info.time_modified;
+                Program::Error("Binary texture atlas cache `", file_name, "` has an image outside of the atlas bounds.");
             }
+
+            // The names are sorted, so we can insert at the end.
+            new_desc.images.emplace_hint(new_desc.images.end(), std::move(name), image_desc);
         }
 
+        // Both dimensions are checked above, so this can't overflow. All size checks happen before allocating.
+        std::size_t pixels_size = std::size_t(image_size.x) * std::size_t(image_size.y) * sizeof(u8vec4);
+        Image new_image(image_size);
+        std::uint8_t *pixels = reinterpret_cast<std::uint8_t *>(&new_image.UnsafeAt(ivec2(0)));
+        if (flags & binary_cache_flag_compressed)
+        {
+            std::vector<std::uint8_t> compressed(file.RemainingBytes());
+            file.Read(compressed.data(), compressed.size());
+            if (Archive::UncompressedSize(compressed.data(), compressed.data() + compressed.size()) != pixels_size)
+                Program::Error("Binary texture atlas cache `", file_name, "` has wrong amount of pixel data.");
+            Archive::Uncompress(compressed.data(), compressed.data() + compressed.size(), pixels);
+        }
+        else
+        {
+            if (file.RemainingBytes() != pixels_size)
+                Program::Error("Binary texture atlas cache `", file_name, "` has wrong amount of pixel data.");
+            // A single read straight into the image. The pixels still end up in an `Image` rather than directly in a texture,
+            // because the atlas image is modified after loading (e.g. the fonts are rendered into it) and uploaded afterwards.
+            file.Read(pixels, pixels_size);
+        }
+
+        image = std::move(new_image);
+        desc = std::move(new_desc);
+    }
+
+    void TextureAtlas::BuildLookupTable()
+    {
+        lookup_table.clear();
+        if (desc.images.empty())
+            return;
+
+        lookup_table.resize(std::bit_ceil(desc.images.size() * 2));
+        std::size_t mask = lookup_table.size() - 1;
+
+        for (const auto &[name, image_desc] : desc.images)
+        {
+            std::uint64_t hash = Hash::String(name);
+
+            std::size_t i = hash & mask;
+            while (lookup_table[i].used)
+                i = (i + 1) & mask;
+
+            LookupEntry &entry = lookup_table[i];
+            entry.used = true;
+            entry.hash = hash;
+            entry.name = name;
+            entry.region.pos = image_desc.pos;
+            entry.region.size = image_desc.size;
+        }
+    }
+
+    TextureAtlas::TextureAtlas(ivec2 target_size, const std::string &source_dir, const std::string &out_image_file, const std::string &out_desc_file, const std::map<std::string, ivec2> &artifical_regions, bool add_gaps, ThreadPool *thread_pool, const BinaryCache &binary_cache, bool shrink_to_fit)
+        : source_dir(source_dir)
+    {
+        constexpr int max_nesting_level = 32;
 
-        // Decide if we should load the atlas or regenerate it.
-        if (!allow_regeneration || source_tree.time_modified_recursive < min(image_time_modified, desc_time_modified))
+        const auto start_time = std::chrono::steady_clock::now();
+        auto lap_time = start_time;
+
+        // Decide if regenrating the atlas should be allowed.
+        bool allow_regeneration = !source_dir.empty();
+
+        // Saves the binary cache, if enabled. Ignores failures.
+        auto SaveBinary = [&]
         {
-            // Try loading the existing atlas because either regeneration is disabled, or atlas image and description are new enough.
+            if (binary_cache.file.empty())
+                return;
             try
             {
-                // Load and parse description.
-                Refl::FromString(desc, Stream::Input(out_desc_file));
+                SaveBinaryCache(binary_cache.file, binary_cache.compress, out_image_file, out_desc_file);
+            }
+            catch (...) {}
+        };
 
-                // Make sure that all requested artifical regions are present in the atlas. If not, attempt to regenerate it.
-                for (const auto &[name, size] : artifical_regions)
+        // Try loading the existing atlas.
+        // If regeneration is allowed, it's still useful, since the unchanged images don't have to be decoded again.
+        bool loaded = false;
+        try
+        {
+            // Try the binary cache first.
+            if (!binary_cache.file.empty())
+            {
+                try
+                {
+                    LoadBinaryCache(binary_cache.file, out_image_file, out_desc_file);
+                    build_stats.loaded_binary_cache = true;
+                }
+                catch (...)
                 {
-                    auto it = desc.images.find(name);
-                    if (it == desc.images.end() || it->second.size != size)
-                        Program::Error("The texture atlas doesn't include some of the requested artifical regions.");
+                    // Fall back to the text description and the image.
+                    desc = {};
+                    image = {};
                 }
+            }
 
-                // Load image.
-                image = Image(out_image_file);
+            // Load and parse description.
+            if (!build_stats.loaded_binary_cache)
+                Refl::FromString(desc, Stream::Input(out_desc_file));
 
-                return; // The atlas was loaded successfully.
-            }
-            catch (...)
+            // Make sure that all requested artifical regions are present in the atlas. If not, attempt to regenerate it.
+            for (const auto &[name, size] : artifical_regions)
             {
-                // Unable to load the atlas.
-                // If regeneration is allowed, we swallow the exception and try to regenerate.
-                // Otherwise the exception is propagated.
-                if (!allow_regeneration)
-                    throw;
+                auto it = desc.images.find(name);
+                if (it == desc.images.end() || it->second.size != size)
+                    Program::Error("The texture atlas doesn't include some of the requested artifical regions.");
             }
+
+            // Load image.
+            if (!build_stats.loaded_binary_cache)
+                image = Image(out_image_file);
+
+            loaded = true;
         }
+        catch (...)
+        {
+            // Unable to load the atlas.
+            // If regeneration is allowed, we swallow the exception and try to regenerate.
+            // Otherwise the exception is propagated.
+            if (!allow_regeneration)
+                throw;
 
-        // Begin regenerating atlas.
+            desc = {};
+            image = {};
+            build_stats.loaded_binary_cache = false;
+        }
+
+        if (!allow_regeneration)
+        {
+            if (!build_stats.loaded_binary_cache)
+                SaveBinary();
+            BuildLookupTable();
+
+            build_stats.image_count = desc.images.size();
+            build_stats.total_seconds = LapSeconds(lap_time);
+            return;
+        }
+
+        // `GetObjectTree` will throw if the source directory doesn't exist.
+        Filesystem::TreeNode source_tree = Filesystem::GetObjectTree(source_dir, max_nesting_level);
+        if (source_tree.info.category != Filesystem::directory)
+            Program::Error("Texture atlas source location `", source_dir, "` is not a directory.");
 
         // Count images.
         int image_count = artifical_regions.size();
@@ -98,10 +322,13 @@ namespace Graphics
             image_count++;
         });
 
-        // Load images.
+        // List images.
         struct Elem
         {
             std::string name;
+            std::string path; // Empty for the artifical regions.
+            std::uint64_t hash = 0; // Hash of the file contents. Zero for the artifical regions.
+            bool changed = false; // Whether the image is new or its contents changed, compared to the loaded atlas. If so, `image` is decoded from the file.
             Image image;
         };
         std::vector<Elem> elem_list;
@@ -123,46 +350,171 @@ namespace Graphics
 
             // Save image name, but first strip source directory name from it.
             new_elem.name = node.path.substr(source_dir.size() + 1); // `+ 1` is for `/`.
-
-            // Load image.
-            new_elem.image = Image(node.path);
+            new_elem.path = node.path;
         });
 
-        // Sort images by name. Otherwise the order sometimes turns out different on different platforms.
-        std::sort(elem_list.begin(), elem_list.end(), [](const Elem &a, const Elem &b){return a.name < b.name;});
+        // Hash the files, and decode the new and changed ones. Each file is processed independently, so this can run in parallel.
+        // This only reads `desc` and `image`, so it's safe.
+        auto ProcessElem = [&](int index)
+        {
+            Elem &elem = elem_list[index];
+            if (elem.path.empty())
+                return;
+
+            Stream::ReadOnlyData file(elem.path);
+            elem.hash = Hash::Bytes(file.data(), file.size());
 
-        // Construct rectangle list for packing.
-        std::vector<Packing::Rect> rect_list;
-        rect_list.reserve(image_count);
+            auto it = desc.images.find(elem.name);
+            elem.changed = it == desc.images.end() || it->second.hash != elem.hash || !image.RectInBounds(it->second.pos, it->second.size);
+            if (elem.changed)
+                elem.image = Image(std::move(file));
+        };
+        if (thread_pool)
+        {
+            thread_pool->ForEachIndex(elem_list.size(), ProcessElem);
+        }
+        else
+        {
+            for (int i = 0; i < int(elem_list.size()); i++)
+                ProcessElem(i);
+        }
+
+        int changed_count = 0;
         for (const Elem &elem : elem_list)
-            rect_list.push_back(elem.image.Size());
+            changed_count += elem.changed;
 
-        // Try packing rectangles.
-        if (Packing::PackRects(target_size, rect_list.data(), rect_list.size(), add_gaps))
-            Program::Error("Unable to fit texture atlas for `", source_dir, "` into a ", target_size.x, 'x', target_size.y, " texture.");
+        build_stats.image_count = elem_list.size();
+        build_stats.changed_images = changed_count;
+        build_stats.decode_seconds = LapSeconds(lap_time);
 
-        // Construct description and final image.
-        image = Image(target_size, u8vec4(0));
-        desc = {}; // In case we started populating it and failed.
-        for (size_t i = 0; i < elem_list.size(); i++)
+        // Returns the atlas image size for the given used size, see `shrink_to_fit`.
+        auto ImageSize = [&](ivec2 used_size)
         {
-            // Add image to description.
-            ImageDesc image_desc;
-            image_desc.pos = rect_list[i].pos;
-            image_desc.size = elem_list[i].image.Size(); // Note that we don't extract sizes from rectangles, since those sizes might include gap size.
-            if (!desc.images.insert({std::move(elem_list[i].name), image_desc}).second)
-                Program::Error("Internal error while generating description for texture atlas for `", source_dir, "`: Duplicate image paths.");
+            if (!shrink_to_fit)
+                return target_size;
+            return max(used_size, 1);
+        };
+
+        // Decide if the existing layout can be kept: it needs the same packing parameters, the same set of images, and the same image sizes.
+        bool keep_layout = loaded && desc.target_size == target_size && desc.add_gaps == add_gaps && desc.images.size() == elem_list.size();
+        if (keep_layout)
+        {
+            // The image must also have the right size, in case `shrink_to_fit` changed.
+            ivec2 used_size = ivec2(0);
+            for (const auto &[name, image_desc] : desc.images)
+                clamp_var_min(used_size, image_desc.pos + image_desc.size);
+            keep_layout = image.Size() == ImageSize(used_size);
+        }
+        if (keep_layout)
+        {
+            for (const Elem &elem : elem_list)
+            {
+                auto it = desc.images.find(elem.name);
+                if (it == desc.images.end() || (elem.changed && elem.image.Size() != it->second.size))
+                {
+                    keep_layout = false;
+                    break;
+                }
+            }
+        }
+
+        if (keep_layout)
+        {
+            if (changed_count == 0)
+            {
+                // Nothing changed.
+                if (!build_stats.loaded_binary_cache)
+                    SaveBinary();
+                BuildLookupTable();
+                build_stats.total_seconds = LapSeconds(lap_time) + build_stats.decode_seconds;
+                return;
+            }
+
+            // Patch the changed images in place.
+            for (Elem &elem : elem_list)
+            {
+                if (!elem.changed)
+                    continue;
+
+                ImageDesc &image_desc = desc.images.at(elem.name);
+                image.UnsafeDrawImage(elem.image, image_desc.pos);
+                image_desc.hash = elem.hash;
+            }
+
+            build_stats.pack_seconds = LapSeconds(lap_time);
+        }
+        else
+        {
+            // Repack everything.
+            build_stats.regenerated = true;
+
+            // Copy the unchanged images from the old atlas, instead of decoding them again.
+            for (Elem &elem : elem_list)
+            {
+                if (elem.changed || elem.path.empty())
+                    continue;
+
+                const ImageDesc &old_desc = desc.images.at(elem.name);
+                elem.image = Image(old_desc.size);
+                for (int y = 0; y < old_desc.size.y; y++)
+                {
+                    const u8vec4 *row = &image.UnsafeAt(old_desc.pos + ivec2(0, y));
+                    std::copy(row, row + old_desc.size.x, &elem.image.UnsafeAt(ivec2(0, y)));
+                }
+            }
+
+            // Sort images by name. Otherwise the order sometimes turns out different on different platforms.
+            std::sort(elem_list.begin(), elem_list.end(), [](const Elem &a, const Elem &b){return a.name < b.name;});
+
+            // Construct rectangle list for packing.
+            std::vector<Packing::Rect> rect_list;
+            rect_list.reserve(image_count);
+            for (const Elem &elem : elem_list)
+                rect_list.push_back(elem.image.Size());
 
-            // Copy this image to target image.
-            image.UnsafeDrawImage(elem_list[i].image, image_desc.pos);
+            // Try packing rectangles.
+            Packing::Params packing_params;
+            packing_params.inner_gaps = add_gaps;
+            Packing::Result packing_result = Packing::PackRects(target_size, rect_list.data(), rect_list.size(), packing_params);
+            if (packing_result.not_packed)
+                Program::Error("Unable to fit texture atlas for `", source_dir, "` into a ", target_size.x, 'x', target_size.y, " texture.");
+            build_stats.used_size = packing_result.used_size;
+            build_stats.occupancy = packing_result.occupancy;
+
+            // Construct description and final image.
+            image = Image(ImageSize(packing_result.used_size), u8vec4(0));
+            desc = {}; // Discard the old layout.
+            desc.target_size = target_size;
+            desc.add_gaps = add_gaps;
+            for (size_t i = 0; i < elem_list.size(); i++)
+            {
+                // Add image to description.
+                ImageDesc image_desc;
+                image_desc.pos = rect_list[i].pos;
+                image_desc.size = elem_list[i].image.Size(); // Note that we don't extract sizes from rectangles, since those sizes might include gap size.
+                image_desc.hash = elem_list[i].hash;
+                if (!desc.images.insert({std::move(elem_list[i].name), image_desc}).second)
+                    Program::Error("Internal error while generating description for texture atlas for `", source_dir, "`: Duplicate image paths.");
+
+                // Copy this image to target image.
+                image.UnsafeDrawImage(elem_list[i].image, image_desc.pos);
+            }
+
+            build_stats.pack_seconds = LapSeconds(lap_time);
         }
 
+        // Whether both the image and the description were saved. Otherwise the binary cache would be stamped with the outdated files.
+        bool saved = true;
+
         // Save final image.
         try
         {
             image.Save(out_image_file);
         }
-        catch (...) {}
+        catch (...)
+        {
+            saved = false;
+        }
 
         // Save description.
         try
@@ -170,6 +522,16 @@ namespace Graphics
             std::string desc_string = Refl::ToString(desc, Refl::ToStringOptions::Pretty());
             Stream::SaveFile(out_desc_file, desc_string, Stream::text);
         }
-        catch (...) {}
+        catch (...)
+        {
+            saved = false;
+        }
+
+        if (saved)
+            SaveBinary();
+        BuildLookupTable();
+
+        build_stats.save_seconds = LapSeconds(lap_time);
+        build_stats.total_seconds = std::chrono::duration<double>(lap_time - start_time).count();
     }
 }
@@ -1,28 +1,37 @@
 #pragma once
 
-#include <ctime>
+#include <cstdint>
 #include <map>
+#include <string_view>
 #include <string>
 #include <type_traits>
 #include <utility>
 #include <vector>
 
 #include "graphics/image.h"
+#include "meta/string_template_params.h"
 #include "program/errors.h"
 #include "reflection/structs.h"
 #include "strings/format.h"
 #include "utils/filesystem.h"
+#include "utils/hash.h"
 #include "utils/mat.h"
 
+class ThreadPool;
+
 namespace Graphics
 {
     class TextureAtlas
     {
         REFL_SIMPLE_STRUCT_WITHOUT_NAMES( ImageDesc
             REFL_DECL(ivec2) pos, size
+            REFL_DECL(std::uint64_t REFL_INIT =0) hash // Hash of the source file contents, see `Hash::Bytes()`. Zero for the artifical regions.
         )
 
         REFL_SIMPLE_STRUCT( Desc
+            // The packing parameters. If they change, the atlas is repacked.
+            REFL_DECL(ivec2 REFL_INIT =ivec2(0)) target_size
+            REFL_DECL(bool REFL_INIT =false) add_gaps
             REFL_DECL(std::map<std::string, ImageDesc>) images
         )
 
@@ -30,6 +39,45 @@ namespace Graphics
         Desc desc;
         std::string source_dir;
 
+      public:
+        // An optional binary copy of the atlas: a sorted name table followed by the raw RGBA pixels, optionally compressed.
+        // It's loaded without parsing the description and decoding the PNG, and the raw pixels are read directly into the atlas image.
+        // It stores the sizes and the modification times of the image and description files, and is rejected if they don't match.
+        // If it's missing, outdated or can't be loaded, the atlas falls back to the image and description files, and recreates the cache.
+        struct BinaryCache
+        {
+            std::string file; // If empty, the binary cache isn't used.
+            bool compress; // Compress the pixels with `Archive::Compress()`. This makes the file much smaller, but slower to load.
+
+            // Not using default member initializers, since this is used as a default argument inside of the class.
+            BinaryCache(std::string file = "", bool compress = false) : file(std::move(file)), compress(compress) {}
+        };
+
+        // How the atlas was obtained, and how long it took.
+        struct BuildStats
+        {
+            bool loaded_binary_cache = false;
+            bool regenerated = false; // True if the layout was recomputed and all images were repacked.
+            int image_count = 0; // Including the artifical regions.
+            int changed_images = 0; // New or modified images. They are decoded, and the rest are reused from the existing atlas.
+            double total_seconds = 0;
+            // Those are only set when regeneration is allowed:
+            double decode_seconds = 0; // Enumerating, hashing and decoding the source images.
+            double pack_seconds = 0; // Packing or patching the atlas image.
+            double save_seconds = 0;
+            // Those are only set when repacking, see `Packing::Result`:
+            ivec2 used_size = ivec2(0); // The part of the atlas that's actually used. If it's much smaller than the atlas, the atlas can be shrunk, see `shrink_to_fit`.
+            double occupancy = 0; // Relative to the maximum size, not to the shrunk one.
+        };
+
+      private:
+        BuildStats build_stats;
+
+        // Those throw on failure.
+        // `image_file` and `desc_file` are the atlas files the cache must stay in sync with.
+        void SaveBinaryCache(const std::string &file_name, bool compress, const std::string &image_file, const std::string &desc_file) const;
+        void LoadBinaryCache(const std::string &file_name, const std::string &image_file, const std::string &desc_file);
+
       public:
         struct Region
         {
@@ -55,6 +103,37 @@ namespace Graphics
             }
         };
 
+      private:
+        // A hash table for `GetOpt()`, built from `desc` when the atlas is loaded.
+        // Uses open addressing with linear probing. The size is a power of two, and at least twice the amount of regions, so there's always an empty slot.
+        struct LookupEntry
+        {
+            bool used = false;
+            std::uint64_t hash = 0;
+            std::string name;
+            Region region;
+        };
+        std::vector<LookupEntry> lookup_table;
+
+        void BuildLookupTable();
+
+      public:
+        // A region name with a precomputed hash. Lookups with it don't allocate.
+        // Use `Get<"name">()` to compute the hash at compile-time.
+        class RegionName
+        {
+            std::string_view name;
+            std::uint64_t hash = 0;
+
+          public:
+            constexpr RegionName(std::string_view name) : name(name), hash(Hash::String(name)) {}
+            constexpr RegionName(const char *name) : RegionName(std::string_view(name)) {}
+            RegionName(const std::string &name) : RegionName(std::string_view(name)) {}
+
+            [[nodiscard]] constexpr std::string_view Name() const {return name;}
+            [[nodiscard]] constexpr std::uint64_t HashValue() const {return hash;}
+        };
+
         class RegionList
         {
             friend class TextureAtlas;
@@ -78,14 +157,24 @@ namespace Graphics
         TextureAtlas() {}
 
         // Pass empty string as `source_dir` to disallow regeneration.
+        // Otherwise the source images are compared with the existing atlas by their content hashes. The changed ones are patched in place if their sizes
+        //   didn't change, and the atlas is only repacked when the layout has to change.
         // `artifical_regions` are empty "images" that are added to the atlas.
-        TextureAtlas(ivec2 target_size, const std::string &source_dir, const std::string &out_image_file, const std::string &out_desc_file, const std::map<std::string, ivec2> &artifical_regions = {}, bool add_gaps = true);
+        // If `thread_pool` is specified, the source images are decoded in parallel. The result is the same as without it.
+        // If `shrink_to_fit` is true, `target_size` is only the maximum size, and the image is cropped to the used part (see `BuildStats::used_size`).
+        //   The resulting size is usually not a power of two.
+        TextureAtlas(ivec2 target_size, const std::string &source_dir, const std::string &out_image_file, const std::string &out_desc_file, const std::map<std::string, ivec2> &artifical_regions = {}, bool add_gaps = true, ThreadPool *thread_pool = nullptr, const BinaryCache &binary_cache = {}, bool shrink_to_fit = false);
 
         [[nodiscard]] const std::string &SourceDirectory() const
         {
             return source_dir;
         }
 
+        [[nodiscard]] const BuildStats &GetBuildStats() const
+        {
+            return build_stats;
+        }
+
         [[nodiscard]] Image &GetImage()
         {
             return image;
@@ -95,33 +184,53 @@ namespace Graphics
             return image;
         }
 
-        [[nodiscard]] bool GetOpt(const std::string &name, Region &target) const // Returns false if no such image.
+        [[nodiscard]] bool GetOpt(RegionName name, Region &target) const // Returns false if no such image.
         {
-            auto it = desc.images.find(name);
-            if (it == desc.images.end())
+            if (lookup_table.empty())
                 return false;
 
-            target.pos = it->second.pos;
-            target.size = it->second.size;
-            return true;
+            std::size_t mask = lookup_table.size() - 1;
+            for (std::size_t i = name.HashValue() & mask;; i = (i + 1) & mask)
+            {
+                const LookupEntry &entry = lookup_table[i];
+                if (!entry.used)
+                    return false;
+                if (entry.hash == name.HashValue() && entry.name == name.Name())
+                {
+                    target = entry.region;
+                    return true;
+                }
+            }
         }
 
-        [[nodiscard]] Region Get(const std::string &name) const
+        [[nodiscard]] Region Get(RegionName name) const
         {
             Region ret;
             if (!GetOpt(name, ret))
-                Program::Error("No image `", name, "` in texture atlas for `", source_dir, "`.");
+                Program::Error("No image `", name.Name(), "` in texture atlas for `", source_dir, "`.");
             return ret;
         }
+        // Same, but the name hash is computed at compile-time. Usage: `atlas.Get<"foo.png">()`.
+        template <Meta::ConstString Name>
+        [[nodiscard]] Region Get() const
+        {
+            constexpr RegionName name(std::string_view(Name.str, Name.size));
+            return Get(name);
+        }
+
         [[nodiscard]] RegionList GetList(const std::string &prefix, int first_index, const std::string &suffix, int count = -1) const
         {
             RegionList ret;
 
+            std::string name = prefix; // Reused for all names, to avoid reallocating it.
+
             int offset = 0;
             while (offset != count)
             {
                 int index = first_index + offset;
-                std::string name = STR((prefix), (index), (suffix));
+                name.resize(prefix.size());
+                name += std::to_string(index);
+                name += suffix;
 
                 Region image;
                 if (!GetOpt(name, image))
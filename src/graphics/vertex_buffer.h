@@ -249,6 +249,11 @@ namespace Graphics
             glBufferData(GL_ARRAY_BUFFER, count * sizeof(T), source, usage);
             data.size = count;
         }
+        // Replaces the storage with a new uninitialized one of the same size, without waiting for the draw calls using the old one to finish.
+        void Orphan(Usage usage = stream_draw) // Binds storage.
+        {
+            SetData(data.size, nullptr, usage);
+        }
         void SetDataPart(int elem_offset, int elem_count, const T *source) // Binds storage.
         {
             SetDataPartBytes(elem_offset * sizeof(T), elem_count * sizeof(T), (const uint8_t *)source);
@@ -217,10 +217,12 @@ namespace Interface
             context_flags |= SDL_GL_CONTEXT_FORWARD_COMPATIBLE_FLAG;
         SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, context_flags);
 
-        // Window flags (resizability)
+        // Window flags (resizability, visibility)
         uint32_t window_flags = SDL_WINDOW_OPENGL;
         if (!settings.fixed_size)
             window_flags |= SDL_WINDOW_RESIZABLE;
+        if (settings.hidden)
+            window_flags |= SDL_WINDOW_HIDDEN;
 
         // Create the window
         data->handle = SDL_CreateWindow(title.c_str(), pos.x, pos.y, size.x, size.y, window_flags);
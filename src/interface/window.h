@@ -33,6 +33,7 @@ namespace Interface
         ivec2 pos = PosCentered();
         ivec2 min_size = ivec2(0);
         bool fixed_size = false;
+        bool hidden = false; // Don't show the window. Useful when only the GL context is needed.
         int display = 0;
 
         int gl_major = CGLFL_GL_MAJOR, gl_minor = CGLFL_GL_MINOR; // 0,0 = don't care.
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstddef>
+#include <new>
 
 #include "utils/bit_manip.h"
 
@@ -29,4 +30,31 @@ namespace Storage
         static_assert(sizeof(std::size_t) >= sizeof(void *)); // If this somehow fires, the integral overload of `Align` must be rewritten to use `uintptr_t`.
         return reinterpret_cast<T *>(Align<Alignment>(reinterpret_cast<std::size_t>(ptr)));
     }
+
+    // An allocator for standard containers, which aligns the storage to `Alignment`.
+    // Example usage: `std::vector<float, Storage::AlignedAllocator<float, 32>>`.
+    template <typename T, std::size_t Alignment>
+    struct AlignedAllocator
+    {
+        static_assert(is_valid_alignment_v<Alignment> && Alignment >= alignof(T), "The alignment is invalid.");
+
+        using value_type = T;
+
+        template <typename U>
+        struct rebind {using other = AlignedAllocator<U, Alignment>;};
+
+        AlignedAllocator() noexcept {}
+        template <typename U> AlignedAllocator(const AlignedAllocator<U, Alignment> &) noexcept {}
+
+        [[nodiscard]] T *allocate(std::size_t n)
+        {
+            return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+        }
+        void deallocate(T *ptr, std::size_t n) noexcept
+        {
+            ::operator delete(ptr, n * sizeof(T), std::align_val_t(Alignment));
+        }
+
+        template <typename U> [[nodiscard]] bool operator==(const AlignedAllocator<U, Alignment> &) const noexcept {return true;}
+    };
 }
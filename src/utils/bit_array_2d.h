@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "program/errors.h"
+#include "strings/format.h"
+#include "utils/mat.h"
+
+// A 2D array of bits.
+// Each row is padded to a whole number of words, so a row can be inspected a word at a time.
+class BitArray2D
+{
+  public:
+    using word_t = std::uint64_t;
+    static constexpr int word_bits = sizeof(word_t) * 8;
+
+  private:
+    ivec2 size_vec;
+    int row_words = 0;
+    std::vector<word_t> storage;
+
+  public:
+    BitArray2D(ivec2 size_vec = ivec2(0)) : size_vec(size_vec), row_words((size_vec.x + word_bits - 1) / word_bits), storage(std::size_t(row_words) * size_vec.y)
+    {
+        ASSERT(size_vec.min() >= 0, "Invalid bit array size.");
+    }
+
+    [[nodiscard]] ivec2 size() const
+    {
+        return size_vec;
+    }
+
+    [[nodiscard]] bool pos_in_range(ivec2 pos) const
+    {
+        return (pos >= 0).all() && (pos < size_vec).all();
+    }
+
+    [[nodiscard]] bool unsafe_get(ivec2 pos) const
+    {
+        ASSERT(pos_in_range(pos), STR("Bit array indices out of range. Indices are ", (pos), " but the array size is ", (size_vec), "."));
+        return (row(pos.y)[pos.x / word_bits] >> (pos.x % word_bits)) & 1;
+    }
+    void unsafe_set(ivec2 pos, bool value)
+    {
+        ASSERT(pos_in_range(pos), STR("Bit array indices out of range. Indices are ", (pos), " but the array size is ", (size_vec), "."));
+        word_t &word = row(pos.y)[pos.x / word_bits];
+        word_t mask = word_t(1) << (pos.x % word_bits);
+        if (value)
+            word |= mask;
+        else
+            word &= ~mask;
+    }
+
+    // Returns false if out of range.
+    [[nodiscard]] bool try_get(ivec2 pos) const
+    {
+        if (!pos_in_range(pos))
+            return false;
+        return unsafe_get(pos);
+    }
+
+    // Returns true if any bit in `[x_begin, x_end)` of row `y` is set.
+    // The span is clipped to the array bounds, so the bits outside of it are treated as zeroes.
+    [[nodiscard]] bool any_in_row_span(int y, int x_begin, int x_end) const
+    {
+        if (y < 0 || y >= size_vec.y)
+            return false;
+        clamp_var_min(x_begin, 0);
+        clamp_var_max(x_end, size_vec.x);
+        if (x_begin >= x_end)
+            return false;
+
+        const word_t *words = row(y);
+        int first = x_begin / word_bits, last = (x_end - 1) / word_bits;
+        word_t first_mask = ~word_t(0) << (x_begin % word_bits);
+        word_t last_mask = ~word_t(0) >> (word_bits - 1 - (x_end - 1) % word_bits);
+
+        if (first == last)
+            return words[first] & first_mask & last_mask;
+
+        if (words[first] & first_mask)
+            return true;
+        for (int i = first + 1; i < last; i++)
+        {
+            if (words[i])
+                return true;
+        }
+        return words[last] & last_mask;
+    }
+
+    // Returns true if any bit in the rectangle `[a, b)` is set.
+    // The rectangle is clipped to the array bounds.
+    [[nodiscard]] bool any_in_rect(ivec2 a, ivec2 b) const
+    {
+        clamp_var_min(a.y, 0);
+        clamp_var_max(b.y, size_vec.y);
+        for (int y = a.y; y < b.y; y++)
+        {
+            if (any_in_row_span(y, a.x, b.x))
+                return true;
+        }
+        return false;
+    }
+
+    // The amount of words in each row.
+    [[nodiscard]] int row_word_count() const
+    {
+        return row_words;
+    }
+    // The padding bits at the end of each row are always zero.
+    [[nodiscard]] word_t *row(int y)
+    {
+        return storage.data() + std::size_t(row_words) * y;
+    }
+    [[nodiscard]] const word_t *row(int y) const
+    {
+        return storage.data() + std::size_t(row_words) * y;
+    }
+};
@@ -38,6 +38,7 @@ namespace Filesystem
         }
 
         ret.time_modified = info.st_mtime; // `struct stat` also contains last access time and last parameter change time, but we don't really need those.
+        ret.size = info.st_size;
 
         if (ok)
             *ok = true;
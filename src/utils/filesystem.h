@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <ctime>
 #include <string>
 #include <vector>
@@ -12,6 +13,7 @@ namespace Filesystem
     {
         ObjCategory category = ObjCategory::other;
         std::time_t time_modified = 0; // Modification of files in nested directories doesn't affect this time.
+        std::uint64_t size = 0; // Only meaningful for files.
     };
 
     // Throws if the file or directory can't be accessed.
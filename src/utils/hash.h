@@ -2,8 +2,10 @@
 
 #include <concepts>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <initializer_list>
+#include <string_view>
 #include <tuple>
 #include <utility>
 
@@ -11,6 +13,31 @@
 
 namespace Hash
 {
+    // Hashes a byte sequence, using 64-bit FNV-1a.
+    // Unlike `std::hash`, the result is the same on all platforms and standard libraries, so it can be saved to files.
+    [[nodiscard]] inline std::uint64_t Bytes(const void *data, std::size_t size)
+    {
+        std::uint64_t hash = 0xcbf29ce484222325;
+        const unsigned char *bytes = static_cast<const unsigned char *>(data);
+        for (std::size_t i = 0; i < size; i++)
+        {
+            hash ^= bytes[i];
+            hash *= 0x100000001b3;
+        }
+        return hash;
+    }
+    // Same as `Bytes()`, but usable at compile-time.
+    [[nodiscard]] constexpr std::uint64_t String(std::string_view str)
+    {
+        std::uint64_t hash = 0xcbf29ce484222325;
+        for (char ch : str)
+        {
+            hash ^= static_cast<unsigned char>(ch);
+            hash *= 0x100000001b3;
+        }
+        return hash;
+    }
+
     // Combines hashes.
     inline void Append(std::size_t &dst, std::size_t src)
     {
@@ -1,26 +1,24 @@
 #include "packing.h"
 
 #include <algorithm>
+#include <cstdint>
 #include <memory>
+#include <numeric>
 #include <vector>
 
 #include <stb_rect_pack.h>
 
 namespace Packing
 {
-    int PackRects(ivec2 target_size, Rect *data, int count, int inner_gaps, int outer_gaps)
+    // Packs `sizes` with `stb_rect_pack`, writes the positions (relative to the box) to `positions`. Returns the amount of rectangles that weren't packed.
+    static int PackSkyline(ivec2 target_size, const std::vector<ivec2> &sizes, std::vector<ivec2> &positions, std::vector<bool> &packed, int heuristic)
     {
-        // Adjust size.
-        target_size -= 2 * outer_gaps;
-        target_size += inner_gaps;
-
         // Make rectangle vector.
-        std::vector<stbrp_rect> rects(count);
-        for (int i = 0; i < count; i++)
+        std::vector<stbrp_rect> rects(sizes.size());
+        for (std::size_t i = 0; i < sizes.size(); i++)
         {
-            ivec2 rect_size = data[i].size + inner_gaps;
-            rects[i].w = rect_size.x;
-            rects[i].h = rect_size.y;
+            rects[i].w = sizes[i].x;
+            rects[i].h = sizes[i].y;
         }
 
         // Allocate a buffer.
@@ -31,22 +29,224 @@ namespace Packing
         // Make a context.
         stbrp_context context;
         stbrp_init_target(&context, target_size.x, target_size.y, packing_buffer.get(), buffer_size); // No cleanup is needed.
+        stbrp_setup_heuristic(&context, heuristic);
 
         // Try packing.
-        bool ok = stbrp_pack_rects(&context, rects.data(), rects.size());
+        stbrp_pack_rects(&context, rects.data(), rects.size());
 
-        // Counts rectangles that weren't packed.
         int rects_not_packed = 0;
-        if (!ok)
-            rects_not_packed = std::count_if(rects.begin(), rects.end(), [](const stbrp_rect &rect){return !rect.was_packed;});
+        for (std::size_t i = 0; i < sizes.size(); i++)
+        {
+            positions[i] = ivec2(rects[i].x, rects[i].y);
+            packed[i] = rects[i].was_packed;
+            rects_not_packed += !rects[i].was_packed;
+        }
+        return rects_not_packed;
+    }
+
+    // The MaxRects algorithm: tracks all maximal free rectangles, and places each rectangle into the one where it fits best.
+    // Based on "A Thousand Ways to Pack the Bin" by Jukka Jylänki.
+    class MaxRects
+    {
+        struct FreeRect
+        {
+            ivec2 pos, size;
+        };
+
+        std::vector<FreeRect> free_rects;
+
+        [[nodiscard]] static bool Contains(const FreeRect &a, const FreeRect &b) // Whether `a` contains `b`.
+        {
+            return (b.pos >= a.pos).all() && (b.pos + b.size <= a.pos + a.size).all();
+        }
+
+        // Splits the free rectangles that intersect the placed rectangle.
+        void SplitFreeRects(ivec2 pos, ivec2 size)
+        {
+            std::size_t old_count = free_rects.size();
+            for (std::size_t i = 0; i < old_count;)
+            {
+                FreeRect free = free_rects[i];
+                ivec2 free_end = free.pos + free.size, end = pos + size;
+
+                if ((pos >= free_end).any() || (end <= free.pos).any())
+                {
+                    i++;
+                    continue;
+                }
+
+                // Add the parts of the free rectangle that are outside of the placed one. They can overlap each other.
+                if (pos.x > free.pos.x)
+                    free_rects.push_back({free.pos, ivec2(pos.x - free.pos.x, free.size.y)});
+                if (end.x < free_end.x)
+                    free_rects.push_back({ivec2(end.x, free.pos.y), ivec2(free_end.x - end.x, free.size.y)});
+                if (pos.y > free.pos.y)
+                    free_rects.push_back({free.pos, ivec2(free.size.x, pos.y - free.pos.y)});
+                if (end.y < free_end.y)
+                    free_rects.push_back({ivec2(free.pos.x, end.y), ivec2(free.size.x, free_end.y - end.y)});
+
+                // Remove the original one. Swapping it with the last old rectangle keeps the new ones at the end.
+                free_rects[i] = free_rects[old_count - 1];
+                free_rects[old_count - 1] = free_rects.back();
+                free_rects.pop_back();
+                old_count--;
+            }
+        }
+
+        // Removes the free rectangles that are contained in other ones.
+        void PruneFreeRects()
+        {
+            for (std::size_t i = 0; i < free_rects.size(); i++)
+            {
+                for (std::size_t j = i + 1; j < free_rects.size();)
+                {
+                    if (Contains(free_rects[i], free_rects[j]))
+                    {
+                        free_rects.erase(free_rects.begin() + j);
+                        continue;
+                    }
+                    if (Contains(free_rects[j], free_rects[i]))
+                    {
+                        free_rects.erase(free_rects.begin() + i);
+                        i--;
+                        break;
+                    }
+                    j++;
+                }
+            }
+        }
+
+      public:
+        MaxRects(ivec2 size)
+        {
+            free_rects.push_back({ivec2(0), size});
+        }
+
+        // Returns false if the rectangle doesn't fit.
+        bool Insert(ivec2 size, bool allow_rotation, ivec2 &out_pos, bool &out_rotated)
+        {
+            bool found = false;
+            int best_short = 0, best_long = 0;
+
+            for (const FreeRect &free : free_rects)
+            {
+                for (bool rotate : {false, true})
+                {
+                    if (rotate && (!allow_rotation || size.x == size.y))
+                        continue;
+
+                    ivec2 this_size = rotate ? ivec2(size.y, size.x) : size;
+                    if ((this_size > free.size).any())
+                        continue;
+
+                    ivec2 leftover = free.size - this_size;
+                    int this_short = leftover.min(), this_long = leftover.max();
+                    if (!found || this_short < best_short || (this_short == best_short && this_long < best_long))
+                    {
+                        found = true;
+                        best_short = this_short;
+                        best_long = this_long;
+                        out_pos = free.pos;
+                        out_rotated = rotate;
+                    }
+                }
+            }
+
+            if (!found)
+                return false;
+
+            SplitFreeRects(out_pos, out_rotated ? ivec2(size.y, size.x) : size);
+            PruneFreeRects();
+            return true;
+        }
+    };
+
+    Result PackRects(ivec2 target_size, Rect *data, int count, const Params &params)
+    {
+        Result ret;
+
+        // Adjust size.
+        ivec2 box_size = target_size;
+        target_size -= 2 * params.outer_gaps;
+        target_size += params.inner_gaps;
+
+        // Make the size list, rotating the rectangles if necessary.
+        std::vector<ivec2> sizes(count);
+        std::vector<bool> rotated(count);
+        for (int i = 0; i < count; i++)
+        {
+            sizes[i] = data[i].size + params.inner_gaps;
+            if (params.allow_rotation && params.algorithm != Algorithm::max_rects_best_short_side_fit && data[i].size.y > data[i].size.x)
+            {
+                sizes[i] = ivec2(sizes[i].y, sizes[i].x);
+                rotated[i] = true;
+            }
+        }
+
+        std::vector<ivec2> positions(count);
+        std::vector<bool> packed(count);
+
+        switch (params.algorithm)
+        {
+          case Algorithm::skyline_bottom_left:
+            ret.not_packed = PackSkyline(target_size, sizes, positions, packed, STBRP_HEURISTIC_Skyline_BL_sortHeight);
+            break;
+          case Algorithm::skyline_best_fit:
+            ret.not_packed = PackSkyline(target_size, sizes, positions, packed, STBRP_HEURISTIC_Skyline_BF_sortHeight);
+            break;
+          case Algorithm::max_rects_best_short_side_fit:
+            {
+                // Place the large rectangles first, this works better. The sort is stable, so the result is deterministic.
+                std::vector<int> order(count);
+                std::iota(order.begin(), order.end(), 0);
+                std::stable_sort(order.begin(), order.end(), [&](int a, int b)
+                {
+                    if (sizes[a].max() != sizes[b].max())
+                        return sizes[a].max() > sizes[b].max();
+                    return sizes[a].prod() > sizes[b].prod();
+                });
+
+                MaxRects packer(target_size);
+                for (int i : order)
+                {
+                    bool this_rotated = false;
+                    packed[i] = packer.Insert(sizes[i], params.allow_rotation, positions[i], this_rotated);
+                    rotated[i] = this_rotated;
+                    ret.not_packed += !packed[i];
+                }
+            }
+            break;
+        }
 
         // Output data.
+        std::int64_t packed_area = 0;
         for (int i = 0; i < count; i++)
         {
-            data[i].pos = ivec2(rects[i].x, rects[i].y) + outer_gaps;
-            data[i].was_packed = rects[i].was_packed;
+            data[i].pos = positions[i] + params.outer_gaps;
+            data[i].was_packed = packed[i];
+            data[i].rotated = packed[i] && rotated[i];
+
+            if (packed[i])
+            {
+                ivec2 size = data[i].rotated ? ivec2(data[i].size.y, data[i].size.x) : data[i].size;
+                packed_area += std::int64_t(size.x) * size.y;
+                clamp_var_min(ret.used_size, data[i].pos + size + params.outer_gaps);
+            }
         }
 
-        return rects_not_packed;
+        if (box_size.min() > 0)
+            ret.occupancy = packed_area / (double(box_size.x) * box_size.y);
+        if (ret.used_size.min() > 0)
+            ret.used_occupancy = packed_area / (double(ret.used_size.x) * ret.used_size.y);
+
+        return ret;
+    }
+
+    int PackRects(ivec2 target_size, Rect *data, int count, int inner_gaps, int outer_gaps)
+    {
+        Params params;
+        params.inner_gaps = inner_gaps;
+        params.outer_gaps = outer_gaps;
+        return PackRects(target_size, data, count, params).not_packed;
     }
 }
@@ -12,12 +12,51 @@ namespace Packing
         // Output:
         ivec2 pos = ivec2(0);
         bool was_packed = 0;
+        bool rotated = 0; // Only if `Params::allow_rotation` is set. If true, the rectangle was rotated by 90 degrees, and occupies `[size.y, size.x]` at `pos`.
 
         Rect() {}
         Rect(ivec2 size) : size(size) {}
     };
 
+    enum class Algorithm
+    {
+        skyline_bottom_left, // `stb_rect_pack`'s skyline packer, with the bottom-left heuristic. Fast.
+        skyline_best_fit, // Same, with the best-fit heuristic.
+        max_rects_best_short_side_fit, // MaxRects with the best short side fit heuristic. Much slower. Fits slightly more into a fixed box, but spreads the rectangles over all of it, so `Result::used_size` is large.
+    };
+
+    struct Params
+    {
+        Algorithm algorithm = Algorithm::skyline_bottom_left;
+
+        // Allow rotating the rectangles by 90 degrees. Only use this if you can handle rotated rectangles, see `Rect::rotated`.
+        // For MaxRects, each rectangle is tried in both orientations. For skyline, the rectangles are rotated to be wider than they are tall.
+        bool allow_rotation = false;
+
+        int inner_gaps = 0;
+        int outer_gaps = 0;
+    };
+
+    struct Result
+    {
+        int not_packed = 0; // The amount of rectangles that didn't fit into the box.
+
+        // The bounding box of the packed rectangles, starting from the top-left corner of the box, including the outer gaps.
+        // If it's much smaller than the box, the box can be shrunk.
+        ivec2 used_size = ivec2(0);
+
+        // The total area of the packed rectangles (without gaps), divided by the area of the box.
+        double occupancy = 0;
+        // Same, but divided by the area of `used_size`.
+        double used_occupancy = 0;
+    };
+
+    // Packs the rectangles into a box of size `target_size`. Never throws on failure, check `Result::not_packed` instead.
+    // Note that skyline packers don't support coordinates outside of [0;65535] range by default. This can be changed in `stb_rect_pack.h`.
+    [[nodiscard]] Result PackRects(ivec2 target_size, Rect *data, int count, const Params &params);
+
     // Returns 0 on success. On failure returns the amount of rectangles that didn't fit into the box.
+    // Uses the skyline bottom-left packer.
     // Note that coordinates outside of [0;65535] range are not supported by default. This can be changed in `stb_rect_pack.h`.
     int PackRects(ivec2 target_size, Rect *data, int count, int inner_gaps = 0, int outer_gaps = 0);
 }
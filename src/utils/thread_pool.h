@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// A fixed set of worker threads, for running loops in parallel.
+// Example usage:
+//     ThreadPool pool;
+//     pool.ForEachIndex(100, [&](int i){...}); // Blocks until all calls finish.
+class ThreadPool
+{
+    struct State
+    {
+        std::mutex mutex;
+        std::condition_variable start_cond, finish_cond;
+
+        bool stop = false;
+        std::size_t generation = 0; // Incremented for each new job.
+        int running_workers = 0; // How many workers are still working on the current job.
+
+        const std::function<void(int)> *func = nullptr;
+        int count = 0;
+        std::atomic_int next_index = 0;
+
+        std::exception_ptr exception; // The first exception thrown by the current job, if any.
+
+        // Calls `func` for the remaining indices.
+        void Work()
+        {
+            int index;
+            while ((index = next_index++) < count)
+            {
+                try
+                {
+                    (*func)(index);
+                }
+                catch (...)
+                {
+                    std::lock_guard lock(mutex);
+                    if (!exception)
+                        exception = std::current_exception();
+                }
+            }
+        }
+    };
+
+    std::unique_ptr<State> state = std::make_unique<State>();
+    std::vector<std::thread> threads;
+
+  public:
+    // `num_threads` includes the calling thread, so 1 means no extra threads. 0 means one per hardware thread.
+    ThreadPool(int num_threads = 0)
+    {
+        if (num_threads <= 0)
+            num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+        for (int i = 1; i < num_threads; i++)
+        {
+            threads.emplace_back([state = state.get()]
+            {
+                std::size_t last_generation = 0;
+                while (true)
+                {
+                    {
+                        std::unique_lock lock(state->mutex);
+                        state->start_cond.wait(lock, [&]{return state->stop || state->generation != last_generation;});
+                        if (state->stop)
+                            return;
+                        last_generation = state->generation;
+                    }
+
+                    state->Work();
+
+                    std::lock_guard lock(state->mutex);
+                    if (--state->running_workers == 0)
+                        state->finish_cond.notify_one();
+                }
+            });
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard lock(state->mutex);
+            state->stop = true;
+        }
+        state->start_cond.notify_all();
+        for (std::thread &thread : threads)
+            thread.join();
+    }
+
+    // The number of threads that run jobs, including the calling thread.
+    [[nodiscard]] int ThreadCount() const
+    {
+        return threads.size() + 1;
+    }
+
+    // Calls `func(i)` for every `i` in `[0, count)`, in parallel and in no particular order.
+    // Blocks until all calls finish. The calling thread participates too.
+    // If any call throws, rethrows the first exception after the remaining calls finish.
+    // Not reentrant: `func` must not call `ForEachIndex()` on the same pool.
+    void ForEachIndex(int count, const std::function<void(int)> &func)
+    {
+        if (count <= 0)
+            return;
+
+        if (threads.empty() || count == 1)
+        {
+            for (int i = 0; i < count; i++)
+                func(i);
+            return;
+        }
+
+        {
+            std::lock_guard lock(state->mutex);
+            state->func = &func;
+            state->count = count;
+            state->next_index = 0;
+            state->exception = nullptr;
+            state->running_workers = threads.size();
+            state->generation++;
+        }
+        state->start_cond.notify_all();
+
+        state->Work();
+
+        std::unique_lock lock(state->mutex);
+        state->finish_cond.wait(lock, [&]{return state->running_workers == 0;});
+        state->func = nullptr;
+
+        if (state->exception)
+            std::rethrow_exception(std::exchange(state->exception, nullptr));
+    }
+};